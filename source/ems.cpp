@@ -27,10 +27,17 @@
 #include <cassert>
 #include <sstream>
 #include <cstring>
+#include <cstdlib>
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <atomic>
+#include <exception>
+#include <thread>
 //#include <stdio>
 
 #include "kicadtoems_config.hpp"
+#include "ems_cache.hpp"
 
 using namespace kicad_to_ems;
 using namespace ems;
@@ -41,6 +48,89 @@ using std::complex;
 
 std::string printMeshSet(std::set<double>& MeshSet);
 
+static const char* s_ModelScriptBegin = "function retval = kicad_pcb_model(CSX)\n";
+static const char* s_ModelScriptEnd = "retval = CSX;\nendfunction\n";
+
+static void add_mesh_lines(MeshLines& Mesh, const MeshLines& Lines)
+{
+    Mesh.X.insert(Lines.X.begin(), Lines.X.end());
+    Mesh.Y.insert(Lines.Y.begin(), Lines.Y.end());
+    Mesh.Z.insert(Lines.Z.begin(), Lines.Z.end());
+}
+
+// records that set up conversion state for all other records
+static bool is_header_record(uint32_t Symbol)
+{
+    return Symbol == SYM_VERSION || Symbol == SYM_HOST || Symbol == SYM_SETUP ||
+           Symbol == SYM_NET;
+}
+
+template <typename T> static void move_append(std::vector<T>& To, std::vector<T>& From)
+{
+    To.reserve(To.size() + From.size());
+    for (size_t i = 0; i < From.size(); i++)
+        To.push_back(std::move(From[i]));
+    From.clear();
+}
+
+// atom text without quotes
+static std::string atom_text(charptr_t Begin, charptr_t End)
+{
+    if (End - Begin >= 2 && *Begin == '"')
+        return std::string(Begin + 1, End - 1);
+    return std::string(Begin, End);
+}
+
+static bool is_copper_layer(const std::string& Layer)
+{
+    return Layer.size() > 3 && Layer.compare(Layer.size() - 3, 3, ".Cu") == 0;
+}
+
+// record passes if it matches any include entry (or include is empty) and no exclude entry,
+// "*.Cu" in record (through hole pads) matches any copper layer in include list
+static bool layer_passes(const Configuration::record_filter_t& Filter, const std::string& Layer)
+{
+    bool included = Filter.include.empty();
+    for (size_t i = 0; i < Filter.include.size() && !included; i++)
+    {
+        const std::string& entry = Filter.include[i];
+        included = entry == Layer || (entry == "*.Cu" && is_copper_layer(Layer)) ||
+                   (Layer == "*.Cu" && is_copper_layer(entry));
+    }
+    if (!included)
+        return false;
+
+    for (size_t i = 0; i < Filter.exclude.size(); i++)
+    {
+        const std::string& entry = Filter.exclude[i];
+        if (entry == Layer || (entry == "*.Cu" && is_copper_layer(Layer)))
+            return false;
+    }
+    return true;
+}
+
+// read first two numeric atoms of record, e.g. "(xy 1.5 -2)"
+static bool read_xy(SREC& Rec, double& X, double& Y)
+{
+    double xy[2];
+    if (Rec.GetDoubles(xy, 2) != 2)
+        return false;
+    X = xy[0];
+    Y = xy[1];
+    return true;
+}
+
+// drill of via record, false if via has no 'drill' field. Convert finds drill of vias
+// before each batch with it too, so both see the same field.
+static bool read_via_drill(SREC Via, double& Drill)
+{
+    if (!Via.GetChild(SYM_DRILL))
+        return false;
+    if (Via.GetDoubles(&Drill, 1) != 1)
+        throw ems_exc("GetVia: 'drill' field read failed");
+    return true;
+}
+
 void PCB_EMS_Model::InjectOpenEMS_Script(const std::string& SourceFile)
 {
 
@@ -69,17 +159,15 @@ void PCB_EMS_Model::InjectOpenEMS_Script(const std::string& SourceFile)
         node->DeleteChild(material);
     }
 
-    GenMaterialSection_XML(m_SimBox.materials.pcb, node);
-    GenMaterialSection_XML(m_SimBox.materials.metal_top, node);
-    GenMaterialSection_XML(m_SimBox.materials.metal_bot, node);
-    GenMaterialSection_XML(m_SimBox.materials.hole_fill, node);
-    GenMaterialSection_XML(m_SimBox.box_fill.box_material, node);
+    for (material_id_t id = 0; id < MaterialRegistry::COUNT; ++id)
+        GenMaterialSection_XML(id, node);
 
     doc.SaveFile(SourceFile.c_str());
 }
 
-void PCB_EMS_Model::GenMaterialSection_XML(Configuration::MaterialProps& Material, XMLElement* Node)
+void PCB_EMS_Model::GenMaterialSection_XML(material_id_t MaterialId, XMLElement* Node)
 {
+    const Configuration::MaterialProps& Material = m_Materials.Get(MaterialId);
     XMLElement* material;
 
     if (Material.IsPEC)
@@ -108,45 +196,22 @@ void PCB_EMS_Model::GenMaterialSection_XML(Configuration::MaterialProps& Materia
         throw ems_exc("TinyXML2 Create NewElement() failed");
     material->InsertEndChild(primitives);
 
-    for (size_t i = 0; i < m_Segments.size(); i++)
-    {
-        m_Segments[i].GetXML_Primitive(primitives, Material.Name);
-    }
-
-    for (size_t i = 0; i < m_Vias.size(); i++)
-    {
-        m_Vias[i].GetXML_Primitive(primitives, Material.Name);
-    }
-
-    for (size_t i = 0; i < m_Polys.size(); i++)
-    {
-        m_Polys[i].GetXML_Primitive(primitives, Material.Name);
-    }
+    m_Segments.GetXML_Primitives(MaterialId, primitives);
+    m_Vias.GetXML_Primitives(MaterialId, primitives);
+    m_Polys.GetXML_Primitives(MaterialId, primitives);
 
     Node->InsertEndChild(material);
 }
 
 std::string PCB_EMS_Model::GetModelScript()
 {
-    std::string str = "function retval = kicad_pcb_model(CSX)\n";
-
-    for (size_t i = 0; i < m_Segments.size(); i++)
-    {
-        str += m_Segments[i].GetCSX_Script();
-    }
-
-    for (size_t i = 0; i < m_Vias.size(); i++)
-    {
-        str += m_Vias[i].GetCSX_Script();
-    }
+    std::string str = s_ModelScriptBegin;
 
-    for (size_t i = 0; i < m_Polys.size(); i++)
-    {
-        str += m_Polys[i].GetCSX_Script();
-    }
+    m_Segments.AppendCSX_Script(str, m_Materials);
+    m_Vias.AppendCSX_Script(str, m_Materials);
+    m_Polys.AppendCSX_Script(str, m_Materials);
 
-    str += "retval = CSX;\n";
-    str += "endfunction\n";
+    str += s_ModelScriptEnd;
 
     return str;
 }
@@ -169,28 +234,12 @@ pems::MeshLines PCB_EMS_Model::GetOmptimalMesh()
     if (m_MeshParams.automatic_mesh.insert_automatic_mesh)
     {
         // get model mesh lines
-        for (size_t i = 0; i < m_Segments.size(); i++)
-        {
-            MeshLines el_mesh = m_Segments[i].GetMeshData();
-            mesh.X.insert(el_mesh.X.begin(), el_mesh.X.end());
-            mesh.Y.insert(el_mesh.Y.begin(), el_mesh.Y.end());
-            mesh.Z.insert(el_mesh.Z.begin(), el_mesh.Z.end());
-        }
-        for (size_t i = 0; i < m_Vias.size(); i++)
-        {
-            MeshLines el_mesh = m_Vias[i].GetMeshData();
-            mesh.X.insert(el_mesh.X.begin(), el_mesh.X.end());
-            mesh.Y.insert(el_mesh.Y.begin(), el_mesh.Y.end());
-            mesh.Z.insert(el_mesh.Z.begin(), el_mesh.Z.end());
-        }
+        m_Segments.AddMeshLines(mesh);
+        m_Vias.AddMeshLines(mesh);
+        m_Polys.AddMeshLines(mesh);
 
-        for (size_t i = 0; i < m_Polys.size(); i++)
-        {
-            MeshLines el_mesh = m_Polys[i].GetMeshData();
-            mesh.X.insert(el_mesh.X.begin(), el_mesh.X.end());
-            mesh.Y.insert(el_mesh.Y.begin(), el_mesh.Y.end());
-            mesh.Z.insert(el_mesh.Z.begin(), el_mesh.Z.end());
-        }
+        // primitives already written in streaming mode
+        add_mesh_lines(mesh, m_StreamMesh);
 
         // insert Z axis mesh
         double line_interval = m_ConvSet.pcb_height / (m_MeshParams.automatic_mesh.pcb_z_lines + 1);
@@ -693,12 +742,13 @@ std::string PCB_EMS_Model::GetMeshScript()
     return str;
 }
 
-PCB_EMS_Model::PCB_EMS_Model(srecs::charvec_t& Data, Configuration& Config)
+PCB_EMS_Model::PCB_EMS_Model(Configuration& Config)
 
     : m_Config(Config),
       m_SimBox(Config.SimulationBox),
       m_MeshParams(Config.mesh_params),
-      m_ConvSet(Config.conversion_settings)
+      m_ConvSet(Config.conversion_settings),
+      m_Materials(Config)
 {
     m_MetalPriority = 1;
     m_PCBPriority = 0;
@@ -709,40 +759,337 @@ PCB_EMS_Model::PCB_EMS_Model(srecs::charvec_t& Data, Configuration& Config)
     {
         Configuration::xyz_triplet<double>& dim_min = Config.SimulationBox.min;
         Configuration::xyz_triplet<double>& dim_max = Config.SimulationBox.max;
-        auto material = Config.SimulationBox.box_fill.box_material;
 
-        std::complex<double> start(dim_min.X, 0);
-        std::complex<double> end(dim_max.X, 0);
-        Segment seg(end, start, dim_min.Z, dim_max.Y - dim_min.Y, dim_max.Z - dim_min.Z, 0,
-                    m_ConvSet.corner_approximation, material);
-        m_Segments.push_back(seg);
+        // native box fills the simulation box exactly
+        if (m_ConvSet.native_boxes)
+        {
+            std::complex<double> min(dim_min.X, dim_min.Y);
+            std::complex<double> max(dim_max.X, dim_max.Y);
+            m_Segments.BeginObject();
+            m_Segments.AddBox(min, max, dim_min.Z, dim_max.Z - dim_min.Z, 0, MaterialRegistry::BOX);
+            m_Segments.AddMeshLineX(dim_min.X);
+            m_Segments.AddMeshLineX(dim_max.X);
+            m_Segments.AddMeshLineY(dim_min.Y);
+            m_Segments.AddMeshLineY(dim_max.Y);
+            m_Segments.AddMeshLineZ(dim_min.Z);
+            m_Segments.AddMeshLineZ(dim_max.Z);
+        }
+        else
+        {
+            std::complex<double> start(dim_min.X, 0);
+            std::complex<double> end(dim_max.X, 0);
+            VertexArena arena;
+            Segment seg(end, start, dim_min.Z, dim_max.Y - dim_min.Y, dim_max.Z - dim_min.Z, 0,
+                        m_ConvSet.corner_approximation, MaterialRegistry::BOX, false, arena);
+            seg.AddTo(m_Segments);
+        }
     }
 
-    m_LastViaDrill = 0.1;
     m_RescueViaDrill = true;
-    m_AuxAxisIsOrigin = true;
+    // set when 'setup' record has 'aux_axis_origin'
+    m_AuxAxisIsOrigin = false;
+
+    m_FilterLayers = !m_ConvSet.layer_filter.include.empty() ||
+                     !m_ConvSet.layer_filter.exclude.empty();
+    m_FilterNets = !m_ConvSet.net_filter.include.empty() || !m_ConvSet.net_filter.exclude.empty();
+    m_FilteredRecords = 0;
+
+    RegisterHandler(SYM_VERSION, &PCB_EMS_Model::GetVersion);
+    RegisterHandler(SYM_HOST, &PCB_EMS_Model::GetHost);
+    RegisterHandler(SYM_SETUP, &PCB_EMS_Model::GetSetup);
+    RegisterHandler(SYM_NET, &PCB_EMS_Model::GetNet);
+    RegisterHandler(SYM_SEGMENT, &PCB_EMS_Model::GetSegment);
+    RegisterHandler(SYM_VIA, &PCB_EMS_Model::GetVia);
+    RegisterHandler(SYM_ZONE, &PCB_EMS_Model::GetZone);
+    RegisterHandler(SYM_MODULE, &PCB_EMS_Model::GetModule);
+    RegisterHandler(SYM_GR_LINE, &PCB_EMS_Model::GetPCB);
+    RegisterHandler(SYM_GR_ARC, &PCB_EMS_Model::GetPCB);
+    RegisterHandler(SYM_GR_CIRCLE, &PCB_EMS_Model::GetPCB);
+    RegisterHandler(SYM_GR_RECT, &PCB_EMS_Model::GetPCB);
+}
 
+void PCB_EMS_Model::Convert(const srecs::InputSource& Data, size_t Jobs)
+{
     // extract metal and pcb primitives for EMS simulation
-    SREC srec(Data.begin(), Data.end());
+    // tokenize once, all record lookups below navigate the tape
+    Tape tape(Data.Begin(), Data.End());
+    SREC srec(tape);
 
     srec.GetNext();
-    if (srec.GetRecName() != "kicad_pcb")
+    if (srec.GetRecSymbol() != SYM_KICAD_PCB)
     {
         std::cout << "Error: not kicad_pcb file format";
         return;
     }
-    srec.GetChild();
 
+    // go trough all records in kicad_pcb record. Header records set up state used
+    // by all other records, so they are handled right away.
+    std::vector<uint32_t> records;
+    BatchContext header;
+    if (srec.GetChild())
+    {
+        do
+        {
+            if (is_header_record(srec.GetRecSymbol()))
+                DispatchRecord(srec, header);
+            else
+                records.push_back(srec.GetPosition());
+        } while (srec.GetNext());
+    }
+
+    if (Jobs == 0)
+        Jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    // several batches per thread, so that slow records (zones) are spread out
+    size_t batch_count = 1;
+    if (Jobs > 1)
+        batch_count = std::max<size_t>(1, std::min(records.size(), Jobs * 8));
+
+    std::vector<BatchContext> batches(batch_count);
+    std::vector<size_t> batch_begin(batch_count + 1);
+    for (size_t b = 0; b <= batch_count; ++b)
+        batch_begin[b] = records.size() * b / batch_count;
+
+    // vias without drill take drill of previous via, find it for each batch start
+    for (size_t b = 1; b < batch_count; ++b)
+    {
+        batches[b].LastViaDrill = batches[b - 1].LastViaDrill;
+        for (size_t i = batch_begin[b - 1]; i < batch_begin[b]; ++i)
+        {
+            srec.SetPosition(records[i]);
+            double drill;
+            if (srec.GetRecSymbol() == SYM_VIA && read_via_drill(srec, drill))
+                batches[b].LastViaDrill = drill;
+        }
+    }
+
+    std::vector<std::exception_ptr> errors(batch_count);
+    std::atomic<size_t> next_batch(0);
+    auto worker = [&]() {
+        SREC rec(tape);
+        size_t b;
+        while ((b = next_batch++) < batch_count)
+        {
+            try
+            {
+                for (size_t i = batch_begin[b]; i < batch_begin[b + 1]; ++i)
+                {
+                    rec.SetPosition(records[i]);
+                    DispatchRecord(rec, batches[b]);
+                }
+            } catch (...)
+            {
+                errors[b] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min(Jobs, batch_count); ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+
+    // merge in file order, so output does not depend on thread count
+    for (size_t b = 0; b < batch_count; ++b)
+    {
+        if (errors[b])
+            std::rethrow_exception(errors[b]);
+        MergeBatch(batches[b]);
+    }
+    ReportFiltered();
+
+    // bounds are indexed once, culling and copper merge keep the index up to date
+    if (m_ConvSet.cull_covered || m_ConvSet.merge_copper)
+    {
+        m_Segments.BuildIndex();
+        m_Polys.BuildIndex();
+    }
+    if (m_ConvSet.cull_covered)
+        CullCovered();
+    if (m_ConvSet.merge_copper)
+        MergeCopper();
+
+    // generate pcb outline
+    GenPCB_Polygon();
+}
+
+void PCB_EMS_Model::ConvertStream(std::FILE* Stream, std::ostream& Model)
+{
+    RecordReader reader(Stream);
+
+    // root name is known after first record, nothing is written for other files
+    charptr_t begin, end;
+    bool more = reader.Next(begin, end);
+    if (more && reader.GetRootName() != "kicad_pcb")
+    {
+        std::cout << "Error: not kicad_pcb file format";
+        return;
+    }
+
+    Model << s_ModelScriptBegin;
+    FlushPrimitives(Model);
+
+    if (m_ConvSet.merge_copper)
+        std::cout << "Warning: copper merge is not supported in streaming mode\n";
+    if (m_ConvSet.cull_covered)
+        std::cout << "Warning: zone coverage culling is not supported in streaming mode\n";
+
+    BatchContext batch;
+    for (; more; more = reader.Next(begin, end))
+    {
+        // only current record is tokenized, primitives are written out right away
+        Tape tape(begin, end);
+        SREC srec(tape);
+        if (srec.GetNext())
+            DispatchRecord(srec, batch);
+        MergeBatch(batch);
+        FlushPrimitives(Model);
+    }
+
+    ReportFiltered();
+
+    // generate pcb outline
+    GenPCB_Polygon();
+    FlushPrimitives(Model);
+
+    Model << s_ModelScriptEnd;
+}
+
+bool PCB_EMS_Model::LoadCache(const char* CacheFile, uint64_t Key)
+{
+    std::ifstream stream(CacheFile, std::ios::in | std::ios::binary);
+    if (!stream.is_open())
+        return false;
+
+    CacheReader reader(stream);
+    try
+    {
+        if (reader.GetU32() != CACHE_MAGIC || reader.GetU32() != CACHE_VERSION ||
+            reader.GetU64() != Key)
+            return false;
+
+        PrimitiveStore segments, vias, polys;
+        segments.Load(reader);
+        vias.Load(reader);
+        polys.Load(reader);
+
+        std::swap(m_Segments, segments);
+        std::swap(m_Vias, vias);
+        std::swap(m_Polys, polys);
+    } catch (const std::runtime_error&)
+    {
+        // corrupt cache, convert again
+        return false;
+    }
+    return true;
+}
+
+void PCB_EMS_Model::SaveCache(const char* CacheFile, uint64_t Key)
+{
+    // write to temporary file first, so other runs never see partial cache
+    std::string tmp_file = std::string(CacheFile) + ".tmp";
+    std::ofstream stream(tmp_file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+    {
+        std::cout << "Warning: can't write cache file " << CacheFile << "\n";
+        return;
+    }
+
+    CacheWriter writer(stream);
+    writer.PutU32(CACHE_MAGIC);
+    writer.PutU32(CACHE_VERSION);
+    writer.PutU64(Key);
+
+    m_Segments.Save(writer);
+    m_Vias.Save(writer);
+    m_Polys.Save(writer);
+
+    stream.close();
+    if (!writer.Good() || stream.fail() || std::rename(tmp_file.c_str(), CacheFile) != 0)
+    {
+        std::remove(tmp_file.c_str());
+        std::cout << "Warning: can't write cache file " << CacheFile << "\n";
+    }
+}
+
+void PCB_EMS_Model::MergeBatch(BatchContext& Batch)
+{
+    m_Segments.Append(Batch.Segments);
+    m_Vias.Append(Batch.Vias);
+    m_Polys.Append(Batch.Polys);
+    Batch.Segments.Clear();
+    Batch.Vias.Clear();
+    Batch.Polys.Clear();
+    move_append(m_PCB_OutlineElements, Batch.OutlineElements);
+    m_FilteredRecords += Batch.Filtered;
+    Batch.Filtered = 0;
+}
+
+void PCB_EMS_Model::ReportFiltered()
+{
+    if (m_FilterLayers || m_FilterNets)
+        std::cout << "Filters skipped " << m_FilteredRecords << " records\n";
+}
+
+// traces and smd pads inside a zone of same layer add nothing to the model, zones are
+// the only primitives in m_Polys until copper is merged and board outline is added
+void PCB_EMS_Model::CullCovered()
+{
+    size_t removed = m_Segments.RemoveCovered(m_Polys);
+    std::cout << "Zones cover " << removed << " primitives, removed\n";
+}
+
+// traces, smd pads and zones of same layer are merged into fewer polygons, model then
+// lists through hole pads and vias before merged copper
+void PCB_EMS_Model::MergeCopper()
+{
+    size_t before = m_Segments.Size() + m_Vias.Size() + m_Polys.Size();
+
+    PrimitiveStore copper;
+    copper.Append(m_Segments);
+    copper.Append(m_Polys);
+    copper.MergeOverlapping();
+    m_Segments.Clear();
+    std::swap(m_Polys, copper);
+
+    size_t after = m_Segments.Size() + m_Vias.Size() + m_Polys.Size();
+    std::cout << "Copper merge: " << before << " primitives merged into " << after << "\n";
+}
+
+void PCB_EMS_Model::FlushPrimitives(std::ostream& Model)
+{
+    std::string script;
+    m_Segments.AppendCSX_Script(script, m_Materials);
+    m_Vias.AppendCSX_Script(script, m_Materials);
+    m_Polys.AppendCSX_Script(script, m_Materials);
+    Model << script;
+
+    if (m_MeshParams.automatic_mesh.insert_automatic_mesh)
+    {
+        m_Segments.AddMeshLines(m_StreamMesh);
+        m_Vias.AddMeshLines(m_StreamMesh);
+        m_Polys.AddMeshLines(m_StreamMesh);
+    }
+
+    m_Segments.Clear();
+    m_Vias.Clear();
+    m_Polys.Clear();
+}
+
+bool PCB_EMS_Model::GetVersion(SREC Srec, BatchContext& /*Out*/)
+{
     // (kicad_pcb (version 4) (host pcbnew "(2015-04-25 BZR 5623)-product")
     // (kicad_pcb (version 20171130) (host pcbnew "(5.0.0-rc2-165-g94891b75f)")
     // (kicad_pcb (version 20171130) (host pcbnew "(5.0.0-rc2-165-g94891b75f)")
     // (kicad_pcb (version 20171130) (host pcbnew 5.1.6-c6e7f7d~86~ubuntu20.04.1)
     // (kicad_pcb (version 20200104) (host pcbnew "(5.99.0-879-ga0698723b)")
 
-    if (srec.GetRecord() != "(version 4)")
+    if (!Srec.AtomEquals(0, "4"))
     {
         std::cout << "Warning: kicad_pcb file version 4.x, may experience some issues\n";
-        if (srec.GetRecord() == "(version 20171130)")
+        if (Srec.AtomEquals(0, "20171130"))
         {
             kicad_version = "5.x";
         }
@@ -750,44 +1097,135 @@ PCB_EMS_Model::PCB_EMS_Model(srecs::charvec_t& Data, Configuration& Config)
         {
             kicad_version = "5.99";
         }
-
-        srec.GetNext();
-        std::cout << "kicad_pcb version " << srec.GetRecord() << "\n";
     }
     else
     {
       kicad_version = "4.x";
     }
+    return true;
+}
+
+bool PCB_EMS_Model::GetHost(SREC Srec, BatchContext& /*Out*/)
+{
+    if (kicad_version != "4.x")
+        std::cout << "kicad_pcb version " << Srec.GetRecord() << "\n";
+    return true;
+}
 
-    srec.GetNext("setup");
-    SREC setup = srec;
-    if (setup.GetChild("aux_axis_origin"))
+bool PCB_EMS_Model::GetSetup(SREC Srec, BatchContext& /*Out*/)
+{
+    if (Srec.GetChild(SYM_AUX_AXIS_ORIGIN))
     {
         double x, y;
-        std::string record;
-        record = setup.GetRecord();
-        if (sscanf(record.c_str(), "(aux_axis_origin %lf %lf", &x, &y) != 2)
+        if (!read_xy(Srec, x, y))
             throw ems_exc("EMS_Model: 'aux_axis_origin' field read failed");
         y = -y;
         m_AuxAxisOrigin = complex<double>(x, y);
+        m_AuxAxisIsOrigin = true;
     }
-    else
+    return true;
+}
+
+bool PCB_EMS_Model::GetNet(SREC Srec, BatchContext& /*Out*/)
+{
+    // (net 1 "GND"), evaluated once so that segments and vias (which only
+    // reference net number) can be filtered by net name
+    if (!m_FilterNets)
+        return true;
+
+    charptr_t begin, end;
+    if (!Srec.GetAtom(0, begin, end))
+        throw ems_exc("GetNet: read failed");
+    std::string number(begin, end);
+    std::string name;
+    if (Srec.GetAtom(1, begin, end))
+        name = atom_text(begin, end);
+
+    long net = std::strtol(number.c_str(), nullptr, 10);
+    if (net < 0)
+        return true;
+    if ((size_t)net >= m_NetPasses.size())
+        m_NetPasses.resize(net + 1, -1);
+    m_NetPasses[net] = NetPasses(number, name);
+    return true;
+}
+
+bool PCB_EMS_Model::NetPasses(const std::string& Number, const std::string& Name)
+{
+    const Configuration::record_filter_t& filter = m_ConvSet.net_filter;
+
+    bool included = filter.include.empty();
+    for (size_t i = 0; i < filter.include.size() && !included; i++)
+        included = filter.include[i] == Number || filter.include[i] == Name;
+    if (!included)
+        return false;
+
+    for (size_t i = 0; i < filter.exclude.size(); i++)
+        if (filter.exclude[i] == Number || filter.exclude[i] == Name)
+            return false;
+    return true;
+}
+
+bool PCB_EMS_Model::PassFilters(SREC Srec)
+{
+    charptr_t begin, end;
+
+    // only copper layers are checked, record passes if any of them passes
+    SREC layers = Srec;
+    if (m_FilterLayers && (layers.GetChild(SYM_LAYER) || layers.GetChild(SYM_LAYERS)))
     {
-        m_AuxAxisIsOrigin = false;
+        bool has_copper = false;
+        bool passes = false;
+        for (size_t i = 0; !passes && layers.GetAtom(i, begin, end); i++)
+        {
+            std::string layer = atom_text(begin, end);
+            if (!is_copper_layer(layer))
+                continue;
+            has_copper = true;
+            passes = layer_passes(m_ConvSet.layer_filter, layer);
+        }
+        if (has_copper && !passes)
+            return false;
     }
 
-    // go trough all records in kicad_pcb record
-    while (srec.GetNext())
+    // (net 3) in segments, vias and zones, (net 3 "GND") in pads
+    SREC net = Srec;
+    if (m_FilterNets)
     {
-        GetSegment(srec);
-        GetVia(srec);
-        GetZone(srec);
-        GetModule(srec);
-        GetPCB(srec);
+        // records without net (unconnected pads) belong to KiCad's unnamed net 0, so an
+        // include list keeps them only if it lists net 0
+        if (!net.GetChild(SYM_NET) || !net.GetAtom(0, begin, end))
+            return NetPasses("0", "");
+
+        std::string number(begin, end);
+        long n = std::strtol(number.c_str(), nullptr, 10);
+        if (n >= 0 && (size_t)n < m_NetPasses.size() && m_NetPasses[n] >= 0)
+            return m_NetPasses[n] != 0;
+
+        // net not declared in top level 'net' record
+        std::string name;
+        if (net.GetAtom(1, begin, end))
+            name = atom_text(begin, end);
+        return NetPasses(number, name);
     }
+    return true;
+}
 
-    // generate pcb outline
-    GenPCB_Polygon();
+void PCB_EMS_Model::RegisterHandler(uint32_t Symbol, RecordHandler Handler)
+{
+    if (Symbol >= m_RecordHandlers.size())
+        m_RecordHandlers.resize(Symbol + 1, nullptr);
+    m_RecordHandlers[Symbol] = Handler;
+}
+
+bool PCB_EMS_Model::DispatchRecord(srecs::SREC& Srec, BatchContext& Out)
+{
+    uint32_t symbol = Srec.GetRecSymbol();
+    if (symbol >= m_RecordHandlers.size() || m_RecordHandlers[symbol] == nullptr)
+        return false;
+    bool handled = (this->*m_RecordHandlers[symbol])(Srec, Out);
+    Out.Arena.Reset();
+    return handled;
 }
 
 void PCB_EMS_Model::GenPCB_Polygon()
@@ -837,40 +1275,29 @@ void PCB_EMS_Model::GenPCB_Polygon()
         }
     }
 
-    bool is_clk_wise = IsClockWiseOrder(points);
+    bool is_clk_wise = IsClockWiseOrder(points.data(), points.size());
 
     if (!is_clk_wise)
     {
         std::reverse(points.begin(), points.end());
     }
 
-    Zone poly(points, 0, 0.2, m_ConvSet.pcb_height, m_PCBPriority, m_ConvSet.corner_approximation,
-              m_SimBox.materials.pcb, true);
-    m_Polys.push_back(poly);
+    VertexArena arena;
+    Zone poly(points, 0, 0.2, m_ConvSet.pcb_height, m_PCBPriority, ArcApprox(0.1), m_Materials,
+              MaterialRegistry::PCB, true, m_ConvSet.native_boxes, arena);
+    poly.AddTo(m_Polys);
 }
 
-bool PCB_EMS_Model::GetPCB(srecs::SREC Srec)
+bool PCB_EMS_Model::GetPCB(srecs::SREC Srec, BatchContext& Out)
 {
-    std::string record_str;
-    std::string rec_name = Srec.GetRecName();
-
-    if (rec_name != "gr_line" && rec_name != "gr_circle" && rec_name != "gr_arc" && rec_name != "gr_rect")
-        return false;
+    uint32_t rec_sym = Srec.GetRecSymbol();
 
     // extract layer information
     SREC rec = Srec;
-    if (!rec.GetChild("layer"))
+    if (!rec.GetChild(SYM_LAYER))
         throw ems_exc("GetPCB: no 'layer' field");
-    record_str = rec.GetRecord();
-
 
-    std::string ll;
-    if (kicad_version != "5.99")
-        ll = "Edge.Cuts";
-    else
-        ll = "\"Edge.Cuts\"";
-
-    if (record_str.find(ll.c_str()) != std::string::npos)
+    if (rec.AtomEquals(0, "Edge.Cuts"))
     {
         // Part of PCB edge layer
         complex<double> endp;
@@ -880,55 +1307,51 @@ bool PCB_EMS_Model::GetPCB(srecs::SREC Srec)
 
         // get data
         rec = Srec;
-        if (!rec.GetChild("end"))
+        if (!rec.GetChild(SYM_END))
             throw ems_exc("GetPCB: no 'end' field");
-        record_str = rec.GetRecord();
-        if (sscanf(record_str.c_str(), "(end %lf %lf", &x, &y) != 2)
+        if (!read_xy(rec, x, y))
             throw ems_exc("GetPCB: 'end' field read failed");
         y = -y;
         endp = complex<double>(x, y);
 
-        if (rec_name == "gr_line" || rec_name == "gr_arc" || rec_name == "gr_rect")
+        if (rec_sym == SYM_GR_LINE || rec_sym == SYM_GR_ARC || rec_sym == SYM_GR_RECT)
         {
             rec = Srec;
-            if (!rec.GetChild("start"))
+            if (!rec.GetChild(SYM_START))
                 throw ems_exc("GetPCB: no 'start' field");
-            record_str = rec.GetRecord();
-            if (sscanf(record_str.c_str(), "(start %lf %lf", &x, &y) != 2)
+            if (!read_xy(rec, x, y))
                 throw ems_exc("GetPCB: 'start' field read failed");
             y = -y;
             startp = complex<double>(x, y);
 
-            if (rec_name == "gr_arc")
+            if (rec_sym == SYM_GR_ARC)
             {
                 rec = Srec;
-                if (!rec.GetChild("angle"))
+                if (!rec.GetChild(SYM_ANGLE))
                     throw ems_exc("GetPCB: no 'angle' field");
-                record_str = rec.GetRecord();
-                if (sscanf(record_str.c_str(), "(angle %lf", &angle) != 1)
+                if (rec.GetDoubles(&angle, 1) != 1)
                     throw ems_exc("GetPCB: 'angle' field read failed");
             }
         }
         else
         {
             rec = Srec;
-            if (!rec.GetChild("center"))
+            if (!rec.GetChild(SYM_CENTER))
                 throw ems_exc("GetPCB: no 'center' field");
-            record_str = rec.GetRecord();
-            if (sscanf(record_str.c_str(), "(center %lf %lf", &x, &y) != 2)
+            if (!read_xy(rec, x, y))
                 throw ems_exc("GetPCB: 'center' field read failed");
             y = -y;
             center = complex<double>(x, y);
         }
 
-        if (rec_name == "gr_line")
+        if (rec_sym == SYM_GR_LINE)
         {
             Line line;
             line.m_Start = MovePoint(startp, m_AuxAxisIsOrigin);
             line.m_End = MovePoint(endp, m_AuxAxisIsOrigin);
-            m_PCB_OutlineElements.push_back(line);
+            Out.OutlineElements.push_back(line);
         }
-        else if (rec_name == "gr_rect")
+        else if (rec_sym == SYM_GR_RECT)
         {
             // add four lines for every rectangle
             
@@ -938,24 +1361,24 @@ bool PCB_EMS_Model::GetPCB(srecs::SREC Srec)
 
             line.m_Start = start;
             line.m_End   = complex<double>(end.real(), start.imag());
-            m_PCB_OutlineElements.push_back(line);
+            Out.OutlineElements.push_back(line);
 
             line.m_Start = complex<double>(end.real(), start.imag());
             line.m_End   = end;
-            m_PCB_OutlineElements.push_back(line);
+            Out.OutlineElements.push_back(line);
             
             line.m_Start = end;
             line.m_End   = complex<double>(start.real(), end.imag());
-            m_PCB_OutlineElements.push_back(line);
+            Out.OutlineElements.push_back(line);
             
             line.m_Start = complex<double>(start.real(), end.imag());;
             line.m_End   = start;
-            m_PCB_OutlineElements.push_back(line);
+            Out.OutlineElements.push_back(line);
         }
-        else if (rec_name == "gr_arc")
+        else if (rec_sym == SYM_GR_ARC)
         {
             // start end angle
-            double approx_angle = M_PI / (m_ConvSet.corner_approximation + 1);
+            double approx_angle = M_PI / (ArcApprox(std::abs(endp - startp)) + 1);
             double line_cnt = ceil(pems::deg_to_radian(angle) / approx_angle);
             double angle_step = pems::deg_to_radian(angle) / line_cnt;
             complex<double> first = endp;
@@ -965,131 +1388,261 @@ bool PCB_EMS_Model::GetPCB(srecs::SREC Srec)
                 Line line;
                 line.m_Start = MovePoint(first, m_AuxAxisIsOrigin);
                 line.m_End = MovePoint(second, m_AuxAxisIsOrigin);
-                m_PCB_OutlineElements.push_back(line);
+                Out.OutlineElements.push_back(line);
                 first = second;
             }
         }
-        else if (rec_name == "gr_circle")
+        else if (rec_sym == SYM_GR_CIRCLE)
         {
         }
     }
     return true;
 }
 
-bool PCB_EMS_Model::GetModule(srecs::SREC Srec)
+bool PCB_EMS_Model::GetModule(srecs::SREC Srec, BatchContext& Out)
 {
-    if (Srec.GetRecName() != "module")
-        return false;
-
     SREC module = Srec;
     SREC module_pos_rec = Srec;
 
     double x, y, rotation;
     rotation = 0;
 
-    if (!module_pos_rec.GetChild("at"))
+    if (!module_pos_rec.GetChild(SYM_AT))
         throw ems_exc("GetModule: 'at' field read failed");
-    std::string record = module_pos_rec.GetRecord();
-    if (sscanf(record.c_str(), "(at %lf %lf %lf", &x, &y, &rotation) < 2)
+    double at[3];
+    size_t at_count = module_pos_rec.GetDoubles(at, 3);
+    if (at_count < 2)
         throw ems_exc("GetModule: 'at' field read failed");
-    y = -y;
-
-    if (module.GetChild("pad"))
+    x = at[0];
+    y = -at[1];
+    if (at_count == 3)
+        rotation = at[2];
+
+    // footprint definition key: hash of lib id, orientation and fields used by GetPad,
+    // read in place from the tape. Pad 'at' holds absolute rotation, so instances share
+    // definition only when placed with same rotation.
+    // Key bytes are kept to tell apart footprints with same hash.
+    CacheHash hash;
+    std::string key;
+    auto add = [&hash, &key](const void* Data, size_t Size) {
+        hash.Add(Data, Size);
+        key.append((const char*)Data, Size);
+    };
+    auto add_span = [&add](charptr_t Begin, charptr_t End) {
+        uint64_t size = End - Begin;
+        add(&size, sizeof(size));
+        add(Begin, size);
+    };
+    charptr_t begin, end;
+    if (module.GetAtom(0, begin, end))
+        add_span(begin, end);
+    add(&rotation, sizeof(rotation));
+
+    static const uint32_t pad_fields[4] = {SYM_AT, SYM_SIZE, SYM_LAYERS, SYM_DRILL};
+    std::vector<uint32_t> pads;
+    if (module.GetChild(SYM_PAD))
     {
         do
         {
-            GetPad(module, x, y, rotation);
-        } while (module.GetNext("pad"));
+            pads.push_back(module.GetPosition());
+            for (size_t i = 1; i < 3; ++i)
+            {
+                bool has_atom = module.GetAtom(i, begin, end);
+                add(&has_atom, sizeof(has_atom));
+                if (has_atom)
+                    add_span(begin, end);
+            }
+            for (size_t i = 0; i < 4; ++i)
+            {
+                SREC field = module;
+                bool has_field = field.GetChild(pad_fields[i]);
+                add(&has_field, sizeof(has_field));
+                if (has_field)
+                {
+                    field.GetRecord(begin, end);
+                    add_span(begin, end);
+                }
+            }
+        } while (module.GetNext(SYM_PAD));
+    }
+    if (pads.empty())
+        return true;
+
+    const FootprintDef& def = GetFootprint(hash.Get(), key, pads, Srec, rotation);
+
+    complex<double> offset = MovePoint(complex<double>(x, y), m_AuxAxisIsOrigin);
+    for (size_t i = 0; i < pads.size(); ++i)
+    {
+        // net filter depends on instance, pads are checked one by one
+        module.SetPosition(pads[i]);
+        if (!PassFilters(module))
+        {
+            Out.Filtered++;
+            continue;
+        }
+
+        const std::pair<bool, size_t>& pad = def.Pads[i];
+        if (pad.first)
+        {
+            def.Vias[pad.second].AddTo(Out.Vias, offset);
+        }
+        else
+        {
+            def.Segments[pad.second].AddTo(Out.Segments, offset);
+        }
     }
 
     return true;
 }
 
-bool PCB_EMS_Model::GetPad(srecs::SREC Srec, double ModuleX, double ModuleY, double ModuleRot)
+const PCB_EMS_Model::FootprintDef& PCB_EMS_Model::GetFootprint(uint64_t Hash,
+                                                               const std::string& Key,
+                                                               const std::vector<uint32_t>& Pads,
+                                                               srecs::SREC Srec,
+                                                               double ModuleRot)
 {
+    auto find = [this, Hash, &Key]() -> const FootprintDef* {
+        auto range = m_Footprints.equal_range(Hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second.Key == Key)
+                return &it->second;
+        }
+        return nullptr;
+    };
+    {
+        std::lock_guard<std::mutex> lock(m_FootprintsLock);
+        if (const FootprintDef* found = find())
+            return *found;
+    }
+
+    // build outside of lock, other thread may build same definition meanwhile
+    std::vector<PadShape> shapes(Pads.size());
+    std::vector<complex<double>> ends(2 * Pads.size());
+    for (size_t i = 0; i < Pads.size(); ++i)
+    {
+        Srec.SetPosition(Pads[i]);
+        GetPad(Srec, ModuleRot, shapes[i], &ends[2 * i]);
+    }
+
+    // module placement (translation is added per instance)
+    Affine2D::Rotation(deg_to_radian(ModuleRot)).Apply(ends.data(), ends.size());
+
     auto& pcb_t = m_ConvSet.pcb_metal_thickness;
     auto& pcb_h = m_ConvSet.pcb_height;
-    auto& corner_approx = m_ConvSet.corner_approximation;
 
-    SREC s_record = Srec;
-
-    if (s_record.GetRecName() != "pad")
+    FootprintDef def;
+    def.Key = Key;
+    for (size_t i = 0; i < shapes.size(); ++i)
     {
-        return false;
+        const PadShape& pad = shapes[i];
+        if (pad.IsVia)
+        {
+            def.Pads.push_back(std::make_pair(true, def.Vias.size()));
+            def.Vias.push_back(Via(ends[2 * i], ends[2 * i + 1], -pcb_t, pad.Width,
+                                   pcb_h + 2 * pcb_t, m_MetalPriority, pad.Approx, pad.Drill,
+                                   pad.Material, MaterialRegistry::HOLE_FILL,
+                                   m_ConvSet.native_cylinders, def.Arena));
+        }
+        else
+        {
+            def.Pads.push_back(std::make_pair(false, def.Segments.size()));
+            def.Segments.push_back(Segment(ends[2 * i], ends[2 * i + 1], pad.Z, pad.Width, pcb_t,
+                                           m_MetalPriority, pad.Approx, pad.Material,
+                                           m_ConvSet.native_boxes, def.Arena));
+        }
     }
 
-    std::string record = s_record.GetRecord();
+    std::lock_guard<std::mutex> lock(m_FootprintsLock);
+    if (const FootprintDef* found = find())
+        return *found;
+    return m_Footprints.emplace(Hash, std::move(def))->second;
+}
+
+// pad shape and its two end points relative to footprint origin, without module rotation
+void PCB_EMS_Model::GetPad(srecs::SREC Srec,
+                           double ModuleRot,
+                           PadShape& Out,
+                           std::complex<double>* Ends)
+{
+    auto& pcb_t = m_ConvSet.pcb_metal_thickness;
+    auto& pcb_h = m_ConvSet.pcb_height;
 
-    char pad_id[record.size()];
-    char type[record.size()];
-    char shape[record.size()];
-    if (sscanf(record.c_str(), "(pad %s %s %s", pad_id, type, shape) != 3)
+    SREC s_record = Srec;
+
+    // (pad <id> <type> <shape> ...
+    charptr_t begin, end;
+    if (!s_record.GetAtom(1, begin, end))
+        throw ems_exc("GetPad: read failed");
+    std::string type(begin, end);
+    if (!s_record.GetAtom(2, begin, end))
         throw ems_exc("GetPad: read failed");
+    std::string shape(begin, end);
 
-    double width, height, layer_height;
+    double width, height;
     double x, y;
     double rotation = 0;
 
     SREC data = s_record;
-    if (!data.GetChild("at"))
+    if (!data.GetChild(SYM_AT))
         throw ems_exc("GetPad: no 'at' field");
-    record = data.GetRecord();
-    if (sscanf(record.c_str(), "(at %lf %lf %lf", &x, &y, &rotation) < 2)
+    double at[3];
+    size_t at_count = data.GetDoubles(at, 3);
+    if (at_count < 2)
         throw ems_exc("GetPad: 'at' field read failed");
-    y = -y;
+    x = at[0];
+    y = -at[1];
+    if (at_count == 3)
+        rotation = at[2];
 
     data = s_record;
-    if (!data.GetChild("size"))
+    if (!data.GetChild(SYM_SIZE))
         throw ems_exc("GetPad: no 'size' field");
-    record = data.GetRecord();
-    if (sscanf(record.c_str(), "(size %lf %lf", &width, &height) != 2)
+    if (!read_xy(data, width, height))
         throw ems_exc("GetPad: 'size' field read failed");
 
     data = s_record;
-    if (!data.GetChild("layers"))
+    if (!data.GetChild(SYM_LAYERS))
         throw ems_exc("GetPad: no 'layers' field");
-    record = data.GetRecord();
-    Configuration::MaterialProps material;
-
-    std::string ll = " ";
-    if (kicad_version != "5.99")
-        ll = "F.Cu";
-    else
-        ll = "\"F.Cu\"";
 
-    if (strstr(record.c_str(), ll.c_str()) != nullptr)
+    if (data.HasAtom("F.Cu"))
     {
-        layer_height = pcb_h;
-        material = m_SimBox.materials.metal_top;
+        Out.Z = pcb_h;
+        Out.Material = MaterialRegistry::METAL_TOP;
     }
     else
     {
-        layer_height = -pcb_t;
-        material = m_SimBox.materials.metal_bot;
+        Out.Z = -pcb_t;
+        Out.Material = MaterialRegistry::METAL_BOT;
     }
 
     double drill_x = 0;
     double drill_y = 0;
-    if (strstr(type, "np_thru_hole") != nullptr || strstr(type, "thru_hole") != nullptr)
+    if (type.find("thru_hole") != std::string::npos)
     {
         // drill pad
         data = s_record;
-        if (!data.GetChild("drill"))
+        if (!data.GetChild(SYM_DRILL))
             throw ems_exc("GetPad: no 'drill' field");
-        record = data.GetRecord();
-        if (strstr(shape, "circle") != nullptr)
+        if (shape.find("circle") != std::string::npos)
         {
-            if (sscanf(record.c_str(), "(drill %lf", &drill_x) != 1) {
+            if (data.GetDoubles(&drill_x, 1) != 1) {
                 throw ems_exc("GetPad: cicle 'drill' field read failed (circle)");
             }
 
             drill_y = drill_x;
         }
-        else if (strstr(shape, "oval") != nullptr)
+        else if (shape.find("oval") != std::string::npos)
         {
-            if (sscanf(record.c_str(), "(drill oval %lf %lf", &drill_x, &drill_y) != 2)
+            double oval[2];
+            if (data.AtomEquals(0, "oval") && data.GetDoubles(oval, 2, 1) == 2)
             {
-                if (sscanf(record.c_str(), "(drill %lf", &drill_x) != 1)
+                drill_x = oval[0];
+                drill_y = oval[1];
+            }
+            else
+            {
+                if (data.GetDoubles(&drill_x, 1) != 1)
                     throw ems_exc("GetPad: oval 'drill' field read failed");
 
                 drill_y = drill_x;
@@ -1097,177 +1650,86 @@ bool PCB_EMS_Model::GetPad(srecs::SREC Srec, double ModuleX, double ModuleY, dou
         }
     }
 
-    // generate primitives
-    if (strstr(type, "smd") != nullptr)
+    // pad is a segment along x axis from -half_length to half_length
+    double half_length;
+    bool is_smd = type.find("smd") != std::string::npos;
+    if (is_smd && shape.find("rect") != std::string::npos)
     {
-        if (strstr(shape, "rect") != nullptr)
-        {
-            complex<double> startp = -width / 2;
-            complex<double> endp = width / 2;
-            startp =
-                rot_vector(startp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            endp = rot_vector(endp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            startp =
-                rot_vector(startp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            endp = rot_vector(endp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            startp = MovePoint(startp, m_AuxAxisIsOrigin);
-            endp = MovePoint(endp, m_AuxAxisIsOrigin);
-
-            Segment seg(startp, endp, layer_height, height, pcb_t, m_MetalPriority, 0, material);
-            m_Segments.push_back(seg);
-        }
-        else
-        {
-            double segment_width;
-            complex<double> startp, endp;
-            if (width > height)
-            {
-                startp = -(width - height) / 2;
-                endp = (width - height) / 2;
-                segment_width = height;
-            }
-            else
-            {
-                startp = -(height - width) / 2;
-                endp = (height - width) / 2;
-                segment_width = width;
-            }
-            startp =
-                rot_vector(startp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            endp = rot_vector(endp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            startp =
-                rot_vector(startp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            endp = rot_vector(endp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            startp = MovePoint(startp, m_AuxAxisIsOrigin);
-            endp = MovePoint(endp, m_AuxAxisIsOrigin);
-
-            Segment seg(startp, endp, layer_height, segment_width, pcb_t, m_MetalPriority,
-                        corner_approx ? corner_approx : 1, material);
-            m_Segments.push_back(seg);
-        }
+        half_length = width / 2;
+        Out.Width = height;
+        Out.Approx = 0;
     }
     else
     {
-        if (strstr(type, "np_thru_hole") != nullptr)
+        if (width > height)
         {
-            double drill;
-            complex<double> startp, endp;
-            if (width > height)
-            {
-                startp = -(width - height) / 2;
-                endp = (width - height) / 2;
-                drill = drill_y;
-            }
-            else
-            {
-                startp = -(height - width) / 2;
-                endp = (height - width) / 2;
-                drill = drill_x;
-            }
-            startp =
-                rot_vector(startp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            endp = rot_vector(endp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            startp =
-                rot_vector(startp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            endp = rot_vector(endp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            startp = MovePoint(startp, m_AuxAxisIsOrigin);
-            endp = MovePoint(endp, m_AuxAxisIsOrigin);
-
-            Via via(startp, endp, -pcb_t, drill / 2, pcb_h + 2 * pcb_t, m_MetalPriority,
-                    corner_approx, drill, material, m_SimBox.materials.hole_fill);
-            m_Vias.push_back(via);
+            half_length = (width - height) / 2;
+            Out.Width = height;
+            Out.Drill = drill_y;
         }
         else
         {
-            double segment_width, drill;
-            complex<double> startp, endp;
-            if (width > height)
-            {
-                startp = -(width - height) / 2;
-                endp = (width - height) / 2;
-                segment_width = height;
-                drill = drill_y;
-            }
-            else
-            {
-                startp = -(height - width) / 2;
-                endp = (height - width) / 2;
-                segment_width = width;
-                drill = drill_x;
-            }
-            startp =
-                rot_vector(startp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            endp = rot_vector(endp, deg_to_radian(rotation - ModuleRot)) + complex<double>(x, y);
-            startp =
-                rot_vector(startp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            endp = rot_vector(endp, deg_to_radian(ModuleRot)) + complex<double>(ModuleX, ModuleY);
-            startp = MovePoint(startp, m_AuxAxisIsOrigin);
-            endp = MovePoint(endp, m_AuxAxisIsOrigin);
-
-            Via via(startp, endp, -pcb_t, segment_width, pcb_h + 2 * pcb_t, m_MetalPriority,
-                    corner_approx, drill, material, m_SimBox.materials.hole_fill);
-            m_Vias.push_back(via);
+            half_length = (height - width) / 2;
+            Out.Width = width;
+            Out.Drill = drill_x;
         }
+        size_t corner_approx = ArcApprox(Out.Width / 2);
+        Out.Approx = (is_smd && !corner_approx) ? 1 : corner_approx;
     }
 
-    return true;
+    Out.IsVia = !is_smd;
+    // non plated hole has no ring
+    if (type.find("np_thru_hole") != std::string::npos)
+        Out.Width = Out.Drill / 2;
+
+    // pad rotation in 'at' is absolute, module rotation is applied by caller
+    Affine2D pad = Affine2D::Rotation(deg_to_radian(rotation - ModuleRot))
+                       .Then(Affine2D::Translation(complex<double>(x, y)));
+    Ends[0] = pad.Apply(complex<double>(-half_length));
+    Ends[1] = pad.Apply(complex<double>(half_length));
 }
 
-bool PCB_EMS_Model::GetZone(SREC Srec)
+bool PCB_EMS_Model::GetZone(srecs::SREC Srec, BatchContext& Out)
 {
     // get all segments of PCB
     double point_x;
     double point_y;
     double width;
-    std::string layer;
-    std::string record;
 
-    if (Srec.GetRecName() != "zone")
-        return false;
+    if (!PassFilters(Srec))
+    {
+        Out.Filtered++;
+        return true;
+    }
 
-    if (! (Srec.GetChild("layer") || Srec.GetChild("layers")) ) {
+    if (! (Srec.GetChild(SYM_LAYER) || Srec.GetChild(SYM_LAYERS)) ) {
         throw ems_exc("GetZone: no 'layer/layers' field");
     }
 
-    record = Srec.GetRecord();
-    layer.insert(layer.begin(), record.begin() + 7, record.end() - 1);
-    double height;
-    Configuration::MaterialProps material;
-
-    std::string ll;
-    std::string ll2;
-    std::string ll3;
+    // multi layer zones ('layers' list) are skipped
+    if (Srec.GetRecSymbol() != SYM_LAYER)
+        return true;
 
-    if (kicad_version != "5.99")
-    {
-        ll = "F.Cu";
-        ll2 = "B.Cu";
-        ll3 = "F&B.Cu";
-    }
-    else
-    {
-        ll = "\"F.Cu\"";
-        ll2 = "\"B.Cu\"";
-        ll3 = "\"F&B.Cu\"";
-    }
+    double height;
+    material_id_t material;
 
-    if (layer == ll.c_str())
+    if (Srec.AtomEquals(0, "F.Cu"))
     {
         height = m_ConvSet.pcb_height;
-        material = m_SimBox.materials.metal_top;
+        material = MaterialRegistry::METAL_TOP;
     }
-    else if (layer == ll2)
+    else if (Srec.AtomEquals(0, "B.Cu"))
     {
         height = -m_ConvSet.pcb_metal_thickness;
-        material = m_SimBox.materials.metal_bot;
+        material = MaterialRegistry::METAL_BOT;
     }
-    else if (layer == ll3)
+    else if (Srec.AtomEquals(0, "F&B.Cu"))
     {
         height = m_ConvSet.pcb_height;
-        material = m_SimBox.materials.metal_top;
+        material = MaterialRegistry::METAL_TOP;
 
         height = -m_ConvSet.pcb_metal_thickness;
-        material = m_SimBox.materials.metal_bot;
+        material = MaterialRegistry::METAL_BOT;
     }
     else
     {
@@ -1276,25 +1738,24 @@ bool PCB_EMS_Model::GetZone(SREC Srec)
     }
 
     // width
-    if (!Srec.GetNext("min_thickness"))
+    if (!Srec.GetNext(SYM_MIN_THICKNESS))
         throw ems_exc("GetZone: no 'min_thickness' field");
-    record = Srec.GetRecord();
-    if (sscanf(record.c_str(), "(min_thickness %lf", &width) != 1)
+    if (Srec.GetDoubles(&width, 1) != 1)
         throw ems_exc("GetZone: 'min_thickness' field read failed");
 
     // points
-    while (Srec.GetNext("filled_polygon"))
+    std::vector<std::complex<double>> points;
+    while (Srec.GetNext(SYM_FILLED_POLYGON))
     {
-        std::vector<std::complex<double>> points;
+        points.clear();
         SREC filled_poly = Srec;
 
-        if (!filled_poly.GetChild("pts"))
+        if (!filled_poly.GetChild(SYM_PTS))
             throw ems_exc("GetZone: no 'pts' field for zone 'filled_polygon'");
 
-        if (!filled_poly.GetChild("xy"))
+        if (!filled_poly.GetChild(SYM_XY))
             throw ems_exc("GetZone: no 'xy' field for zone 'filled_polygon' 'pts'");
-        record = filled_poly.GetRecord();
-        if (sscanf(record.c_str(), "(xy %lf %lf", &point_x, &point_y) != 2)
+        if (!read_xy(filled_poly, point_x, point_y))
             throw ems_exc("GetZone: 'xy' field read failed");
         point_y = -point_y;
         auto first = complex<double>(point_x, point_y);
@@ -1302,10 +1763,9 @@ bool PCB_EMS_Model::GetZone(SREC Srec)
         points.push_back(first);
 
         // while there are points to parse
-        while (filled_poly.GetNext("xy"))
+        while (filled_poly.GetNext(SYM_XY))
         {
-            record = filled_poly.GetRecord();
-            if (sscanf(record.c_str(), "(xy %lf %lf", &point_x, &point_y) != 2)
+            if (!read_xy(filled_poly, point_x, point_y))
                 throw ems_exc("GetZone: 'xy' field read failed");
             point_y = -point_y;
             auto p = complex<double>(point_x, point_y);
@@ -1318,16 +1778,19 @@ bool PCB_EMS_Model::GetZone(SREC Srec)
         {
             points.erase(points.end() - 1);
         }
+        if (m_ConvSet.zone_tolerance > 0)
+            Zone::ApproximatePolygon(points, m_ConvSet.zone_tolerance);
         Zone poly(points, height, width, m_ConvSet.pcb_metal_thickness, m_MetalPriority,
-                  m_ConvSet.corner_approximation, material, false);
+                  ArcApprox(width / 2), m_Materials, material, false, m_ConvSet.native_boxes,
+                  Out.Arena);
 
-        m_Polys.push_back(poly);
+        poly.AddTo(Out.Polys);
     }
 
     return true;
 }
 
-bool PCB_EMS_Model::GetSegment(SREC Srec)
+bool PCB_EMS_Model::GetSegment(srecs::SREC Srec, BatchContext& Out)
 {
     // get all segments of PCB
     double start_x;
@@ -1335,126 +1798,108 @@ bool PCB_EMS_Model::GetSegment(SREC Srec)
     double end_x;
     double end_y;
     double width;
-    std::string layer;
-    std::string record;
 
-    if (Srec.GetRecName() != "segment")
-        return false;
+    if (!PassFilters(Srec))
+    {
+        Out.Filtered++;
+        return true;
+    }
 
-    if (!Srec.GetChild("start"))
+    if (!Srec.GetChild(SYM_START))
         throw ems_exc("GetSegment: no 'start' field");
-    record = Srec.GetRecord();
-    if (sscanf(record.c_str(), "(start %lf %lf", &start_x, &start_y) != 2)
+    if (!read_xy(Srec, start_x, start_y))
         throw ems_exc("GetSegment: 'start' field read failed");
     start_y = -start_y;
 
-    if (!Srec.GetNext("end"))
+    if (!Srec.GetNext(SYM_END))
         throw ems_exc("GetSegment: no 'end' field");
-    record = Srec.GetRecord();
-    if (sscanf(record.c_str(), "(end %lf %lf", &end_x, &end_y) != 2)
+    if (!read_xy(Srec, end_x, end_y))
         throw ems_exc("GetSegment: 'end' field read failed");
     end_y = -end_y;
 
-    if (!Srec.GetNext("width"))
+    if (!Srec.GetNext(SYM_WIDTH))
         throw ems_exc("GetSegment: no 'width' field");
-    record = Srec.GetRecord();
-    if (sscanf(record.c_str(), "(width %lf", &width) != 1)
+    if (Srec.GetDoubles(&width, 1) != 1)
         throw ems_exc("GetSegment: 'width' field read failed");
 
-    if (!Srec.GetNext("layer"))
+    if (!Srec.GetNext(SYM_LAYER))
         throw ems_exc("GetSegment: no 'layer' field");
-    ;
-    record = Srec.GetRecord();
-    layer.insert(layer.begin(), record.begin() + 7, record.end() - 1);
 
     auto a = std::complex<double>(start_x, start_y);
     auto b = std::complex<double>(end_x, end_y);
     a = MovePoint(a, m_AuxAxisIsOrigin);
     b = MovePoint(b, m_AuxAxisIsOrigin);
     double height;
-    Configuration::MaterialProps material;
-
-    std::string ll;
-    if (kicad_version != "5.99")
-    {
-        ll = "F.Cu";
-    }
-    else
-    {
-        ll = "\"F.Cu\"";
-    }
+    material_id_t material;
 
-    if (layer == ll.c_str())
+    if (Srec.AtomEquals(0, "F.Cu"))
     {
         height = m_ConvSet.pcb_height;
-        material = m_SimBox.materials.metal_top;
+        material = MaterialRegistry::METAL_TOP;
     }
     else
     {
         height = -m_ConvSet.pcb_metal_thickness;
-        material = m_SimBox.materials.metal_bot;
+        material = MaterialRegistry::METAL_BOT;
     }
 
     Segment seg(a, b, height, width, m_ConvSet.pcb_metal_thickness, m_MetalPriority,
-                m_ConvSet.corner_approximation, material);
+                ArcApprox(width / 2), material, m_ConvSet.native_boxes, Out.Arena);
 
-    m_Segments.push_back(seg);
+    seg.AddTo(Out.Segments);
 
     //    std::cout << "segment" << std::endl;
 
     return true;
 }
 
-bool PCB_EMS_Model::GetVia(srecs::SREC Srec)
+bool PCB_EMS_Model::GetVia(srecs::SREC Srec, BatchContext& Out)
 {
     // get all segments of PCB
     double start_x;
     double start_y;
     double size, drill;
-    std::string record;
+    bool passes = PassFilters(Srec);
+    SREC via_rec = Srec;
 
-    if (Srec.GetRecName() != "via")
-        return false;
-
-    if (!Srec.GetChild("at"))
+    if (!Srec.GetChild(SYM_AT))
         throw ems_exc("GetVia: no 'at' field");
-    record = Srec.GetRecord();
-    if (sscanf(record.c_str(), "(at %lf %lf", &start_x, &start_y) != 2)
+    if (!read_xy(Srec, start_x, start_y))
         throw ems_exc("GetVia: 'at' field read failed");
     start_y = -start_y;
 
-    if (!Srec.GetNext("size"))
+    if (!Srec.GetNext(SYM_SIZE))
         throw ems_exc("GetVia: no 'size' field");
-    record = Srec.GetRecord();
-    if (sscanf(record.c_str(), "(size %lf", &size) != 1)
+    if (Srec.GetDoubles(&size, 1) != 1)
         throw ems_exc("GetVia: 'size' field read failed");
 
-    if (!Srec.GetNext("drill"))
+    if (!read_via_drill(via_rec, drill))
     {
         if (!m_RescueViaDrill)
             throw ems_exc("GetVia: no 'drill' field");
-        drill = m_LastViaDrill;
+        drill = Out.LastViaDrill;
     }
-    else
+
+    // filtered vias still set drill for following vias
+    Out.LastViaDrill = drill;
+    if (!passes)
     {
-        record = Srec.GetRecord();
-        if (sscanf(record.c_str(), "(drill %lf", &drill) != 1)
-            throw ems_exc("GetVia: 'drill' field read failed");
+        Out.Filtered++;
+        return true;
     }
 
-    m_LastViaDrill = drill;
-
     auto a = std::complex<double>(start_x, start_y);
     a = MovePoint(a, m_AuxAxisIsOrigin);
 
     auto pcb_t = m_ConvSet.pcb_metal_thickness;
     auto pcb_h = m_ConvSet.pcb_height;
-    auto corner_approx = m_ConvSet.corner_approximation;
+    auto corner_approx = ArcApprox(size / 2);
 
     Via via(a, a, -pcb_t, size, pcb_h + 2 * pcb_t, m_MetalPriority, corner_approx, drill,
-            m_SimBox.materials.metal_top, m_SimBox.materials.hole_fill);
+            MaterialRegistry::METAL_TOP, MaterialRegistry::HOLE_FILL, m_ConvSet.native_cylinders,
+            Out.Arena);
 
-    m_Vias.push_back(via);
+    via.AddTo(Out.Vias);
 
     return true;
 }
@@ -1468,6 +1913,12 @@ std::complex<double> PCB_EMS_Model::MovePoint(std::complex<double> Point, bool M
     return Point;
 }
 
+size_t PCB_EMS_Model::ArcApprox(double Radius) const
+{
+    return pems::arc_approximation(Radius, m_ConvSet.arc_tolerance,
+                                   m_ConvSet.corner_approximation);
+}
+
 std::string printMeshSet(std::set<double>& MeshSet)
 {
     std::string str;
@@ -21,7 +21,12 @@
 #define ems_h
 
 #include "ems_prims.hpp"
+#include "input_source.hpp"
 #include <tinyxml2.h>
+#include <cstdio>
+#include <ostream>
+#include <unordered_map>
+#include <mutex>
 
 extern int g_ERROR;
 
@@ -36,7 +41,19 @@ namespace ems
 class PCB_EMS_Model
 {
 public:
-    PCB_EMS_Model(srecs::charvec_t& Data, Configuration& Config);
+    PCB_EMS_Model(Configuration& Config);
+
+    // Convert whole PCB file held in memory, records are split between Jobs threads
+    // (0 - one per hardware thread), result does not depend on the thread count
+    void Convert(const srecs::InputSource& Data, size_t Jobs = 1);
+    // Convert PCB file record by record, model script is written to Model while the
+    // stream is read and only mesh lines are kept in memory
+    void ConvertStream(std::FILE* Stream, std::ostream& Model);
+
+    // Replace primitives with ones stored in cache file, false if file is missing,
+    // was written for other key or is corrupt
+    bool LoadCache(const char* CacheFile, uint64_t Key);
+    void SaveCache(const char* CacheFile, uint64_t Key);
 
     std::string GetModelScript();
     std::string GetMeshScript();
@@ -47,14 +64,18 @@ private:
     // error for gap size comparison
     static constexpr double GAP_ERROR = 0.01;
 
-    std::vector<pems::Segment> m_Segments;
-    std::vector<pems::Via> m_Vias;
-    std::vector<pems::Zone> m_Polys;
+    // model script lists all segments, then vias and zones
+    pems::PrimitiveStore m_Segments;
+    pems::PrimitiveStore m_Vias;
+    pems::PrimitiveStore m_Polys;
     std::vector<pems::Line> m_PCB_OutlineElements;
+    // mesh lines of primitives already written in streaming mode
+    pems::MeshLines m_StreamMesh;
     Configuration& m_Config;
     Configuration::SimulationBox_t& m_SimBox;
     Configuration::mesh_params_t& m_MeshParams;
     Configuration::conversion_settings_t& m_ConvSet;
+    pems::MaterialRegistry m_Materials;
     size_t m_MetalPriority;
     size_t m_PCBPriority;
     std::complex<double> m_AuxAxisOrigin;
@@ -64,22 +85,101 @@ private:
     std::string kicad_version;
 
     bool m_RescueViaDrill;
-    double m_LastViaDrill;
 
-    bool GetSegment(srecs::SREC Srec);
-    bool GetVia(srecs::SREC Srec);
-    bool GetZone(srecs::SREC Srec);
-    bool GetModule(srecs::SREC Srec);
-    bool GetPCB(srecs::SREC Srec);
-    bool GetPad(srecs::SREC Srec, double ModuleX, double ModuleY, double ModuleRot);
+    // record filters from configuration, checked before record contents are parsed
+    bool m_FilterLayers;
+    bool m_FilterNets;
+    // filter result of top level 'net' records indexed by net number, -1 - not declared
+    std::vector<signed char> m_NetPasses;
+    size_t m_FilteredRecords;
+
+    // primitives generated from a run of top level records, merged into the model in
+    // file order
+    struct BatchContext {
+        pems::PrimitiveStore Segments;
+        pems::PrimitiveStore Vias;
+        pems::PrimitiveStore Polys;
+        std::vector<pems::Line> OutlineElements;
+        // drill of last via, used for vias without 'drill' field
+        double LastViaDrill = 0.1;
+        // records skipped by layer/net filters
+        size_t Filtered = 0;
+        // outlines of primitives of current record, reset after record is stored
+        pems::VertexArena Arena;
+    };
+
+    // pad primitives of one footprint definition, built at footprint origin and
+    // translated to each instance
+    struct FootprintDef {
+        // hashed key bytes, compared on lookup so that a hash collision can't share
+        // definition of another footprint
+        std::string Key;
+        std::vector<pems::Segment> Segments;
+        std::vector<pems::Via> Vias;
+        // for each pad: true - via, index into Segments or Vias
+        std::vector<std::pair<bool, size_t>> Pads;
+        // pad outlines
+        pems::VertexArena Arena;
+    };
+
+    // pad read by GetPad, its end points are kept apart so that module rotation can be
+    // applied to all pads of footprint at once
+    struct PadShape {
+        bool IsVia;
+        // segment width or via ring width
+        double Width;
+        double Drill;
+        double Z;
+        size_t Approx;
+        pems::material_id_t Material;
+    };
+
+    // keyed by hash of lib id, orientation and pad geometry fields, definitions with same
+    // hash are told apart by their Key; shared between threads
+    std::unordered_multimap<uint64_t, FootprintDef> m_Footprints;
+    std::mutex m_FootprintsLock;
+
+    typedef bool (PCB_EMS_Model::*RecordHandler)(srecs::SREC Srec, BatchContext& Out);
+
+    // top level record handlers indexed by record name symbol
+    std::vector<RecordHandler> m_RecordHandlers;
+
+    void RegisterHandler(uint32_t Symbol, RecordHandler Handler);
+    bool DispatchRecord(srecs::SREC& Srec, BatchContext& Out);
+    void MergeBatch(BatchContext& Batch);
+
+    bool GetVersion(srecs::SREC Srec, BatchContext& Out);
+    bool GetHost(srecs::SREC Srec, BatchContext& Out);
+    bool GetSetup(srecs::SREC Srec, BatchContext& Out);
+    bool GetNet(srecs::SREC Srec, BatchContext& Out);
+    bool GetSegment(srecs::SREC Srec, BatchContext& Out);
+    bool GetVia(srecs::SREC Srec, BatchContext& Out);
+    bool GetZone(srecs::SREC Srec, BatchContext& Out);
+    bool GetModule(srecs::SREC Srec, BatchContext& Out);
+    bool GetPCB(srecs::SREC Srec, BatchContext& Out);
+    void GetPad(srecs::SREC Srec, double ModuleRot, PadShape& Out, std::complex<double>* Ends);
+    const FootprintDef& GetFootprint(uint64_t Hash,
+                                     const std::string& Key,
+                                     const std::vector<uint32_t>& Pads,
+                                     srecs::SREC Srec,
+                                     double ModuleRot);
+
+    bool PassFilters(srecs::SREC Srec);
+    bool NetPasses(const std::string& Number, const std::string& Name);
+    void ReportFiltered();
+    void CullCovered();
+    void MergeCopper();
 
     void GenPCB_Polygon();
+    void FlushPrimitives(std::ostream& Model);
 
-    void GenMaterialSection_XML(Configuration::MaterialProps& Material, tinyxml2::XMLElement* Node);
+    void GenMaterialSection_XML(pems::material_id_t Material, tinyxml2::XMLElement* Node);
 
     pems::MeshLines GetOmptimalMesh();
 
     std::complex<double> MovePoint(std::complex<double> Point, bool Move);
+    // corner approximation for arc of Radius, fixed or from configured arc tolerance
+    size_t ArcApprox(double Radius) const;
 
     void FilterMesh(std::set<double>& Mesh, double MinGap);
     void SmoothMesh(std::set<double>& Mesh, double MaxGap);
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ems_arena.hpp"
+
+#include <algorithm>
+
+using namespace kicad_to_ems;
+using namespace kicad_to_ems::pems;
+
+VertexSpan VertexArena::Allocate(size_t Count)
+{
+    // skip blocks without enough free space, large requests get their own block
+    while (m_Current < m_Blocks.size() && m_Blocks[m_Current].Size - m_Used < Count)
+    {
+        m_Current++;
+        m_Used = 0;
+    }
+    if (m_Current == m_Blocks.size())
+    {
+        Block block;
+        block.Size = std::max(m_BlockSize, Count);
+        block.Data.reset(new std::complex<double>[block.Size]);
+        m_Blocks.push_back(std::move(block));
+        m_Used = 0;
+    }
+
+    VertexSpan span;
+    span.Data = m_Blocks[m_Current].Data.get() + m_Used;
+    span.Size = Count;
+    m_Used += Count;
+    return span;
+}
+
+VertexSpan VertexArena::Copy(const std::complex<double>* Data, size_t Count)
+{
+    VertexSpan span = Allocate(Count);
+    std::copy(Data, Data + Count, span.Data);
+    return span;
+}
+
+void VertexArena::Reset()
+{
+    m_Current = 0;
+    m_Used = 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ems_arena_h
+#define ems_arena_h
+
+#include <complex>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace kicad_to_ems
+{
+namespace pems
+{
+
+/**
+    @brief Vertices allocated from VertexArena, valid until arena is reset
+*/
+struct VertexSpan {
+    std::complex<double>* Data = nullptr;
+    size_t Size = 0;
+
+    std::complex<double>& operator[](size_t Index) const { return Data[Index]; }
+    std::complex<double>* begin() const { return Data; }
+    std::complex<double>* end() const { return Data + Size; }
+    bool empty() const { return Size == 0; }
+};
+
+/**
+    @brief Bump allocator for outline vertices of primitives under construction
+
+    Vertices are taken from large blocks and are never freed one by one. Reset()
+    drops all spans at once and keeps the blocks, so a reused arena stops
+    allocating memory after the first few records.
+*/
+class VertexArena
+{
+public:
+    explicit VertexArena(size_t BlockSize = 1 << 14) : m_BlockSize(BlockSize) {}
+
+    VertexSpan Allocate(size_t Count);
+    VertexSpan Copy(const std::complex<double>* Data, size_t Count);
+    void Reset();
+
+private:
+    struct Block {
+        std::unique_ptr<std::complex<double>[]> Data;
+        size_t Size;
+    };
+
+    std::vector<Block> m_Blocks;
+    size_t m_BlockSize;
+    // block allocations are taken from and number of its used vertices
+    size_t m_Current = 0;
+    size_t m_Used = 0;
+};
+
+} // namespace pems
+} // namespace kicad_to_ems
+
+#endif // ems_arena_h
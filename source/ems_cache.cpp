@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ems_cache.hpp"
+
+#include <stdexcept>
+
+using namespace kicad_to_ems;
+using namespace kicad_to_ems::pems;
+
+class cache_exc : public std::runtime_error
+{
+public:
+    cache_exc(const char* Msg) : std::runtime_error(Msg) {}
+};
+
+void CacheHash::Add(const void* Data, size_t Size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(Data);
+    for (size_t i = 0; i < Size; ++i)
+    {
+        m_Hash ^= bytes[i];
+        m_Hash *= 1099511628211ull;
+    }
+}
+
+void CacheHash::Add(const std::string& Value)
+{
+    Add((uint64_t)Value.size());
+    Add(Value.data(), Value.size());
+}
+
+void CacheHash::Add(const Configuration::MaterialProps& Material)
+{
+    Add(Material.Name);
+    Add(Material.IsPEC);
+    Add(Material.Epsilon);
+    Add(Material.Mue);
+    Add(Material.Kappa);
+    Add(Material.Sigma);
+    Add(Material.Density);
+    Add(Material.boundary_one_third_rule);
+    Add(Material.boundary_additional_lines);
+    Add(Material.boundary_rule_distance);
+}
+
+void CacheHash::Add(const Configuration::record_filter_t& Filter)
+{
+    Add((uint64_t)Filter.include.size());
+    for (size_t i = 0; i < Filter.include.size(); ++i)
+        Add(Filter.include[i]);
+    Add((uint64_t)Filter.exclude.size());
+    for (size_t i = 0; i < Filter.exclude.size(); ++i)
+        Add(Filter.exclude[i]);
+}
+
+uint64_t kicad_to_ems::pems::CacheKey(const char* Begin, const char* End, const Configuration& Config)
+{
+    CacheHash hash;
+    hash.Add((uint64_t)CACHE_VERSION);
+    hash.Add((uint64_t)(End - Begin));
+    hash.Add(Begin, End - Begin);
+
+    const Configuration::conversion_settings_t& conv = Config.conversion_settings;
+    hash.Add(conv.pcb_height);
+    hash.Add(conv.pcb_metal_thickness);
+    hash.Add(conv.pcb_metal_zero_thick);
+    hash.Add((uint64_t)conv.corner_approximation);
+    hash.Add(conv.arc_tolerance);
+    hash.Add(conv.zone_tolerance);
+    hash.Add(conv.layer_filter);
+    hash.Add(conv.net_filter);
+    hash.Add(conv.merge_copper);
+    hash.Add(conv.cull_covered);
+    hash.Add(conv.native_cylinders);
+    hash.Add(conv.native_boxes);
+
+    // simulation box is used for box fill segment
+    const Configuration::SimulationBox_t& box = Config.SimulationBox;
+    hash.Add(box.box_fill.use_box_fill);
+    hash.Add(box.min.X);
+    hash.Add(box.min.Y);
+    hash.Add(box.min.Z);
+    hash.Add(box.max.X);
+    hash.Add(box.max.Y);
+    hash.Add(box.max.Z);
+    hash.Add(box.box_fill.box_material);
+    hash.Add(box.materials.pcb);
+    hash.Add(box.materials.metal_top);
+    hash.Add(box.materials.metal_bot);
+    hash.Add(box.materials.hole_fill);
+
+    return hash.Get();
+}
+
+void CacheReader::Read(void* Data, size_t Size)
+{
+    if (!m_Stream.read((char*)Data, Size))
+        throw cache_exc("Cache: unexpected end of file");
+}
+
+uint32_t CacheReader::GetU32()
+{
+    uint32_t value;
+    Read(&value, sizeof(value));
+    return value;
+}
+
+uint64_t CacheReader::GetU64()
+{
+    uint64_t value;
+    Read(&value, sizeof(value));
+    return value;
+}
+
+double CacheReader::GetDouble()
+{
+    double value;
+    Read(&value, sizeof(value));
+    return value;
+}
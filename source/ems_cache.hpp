@@ -0,0 +1,130 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ems_cache_h
+#define ems_cache_h
+
+#include "kicadtoems_config.hpp"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace kicad_to_ems
+{
+namespace pems
+{
+
+/**
+    @brief Binary cache file format
+
+    Header is magic, format version and key, followed by primitive lists. Values are
+    stored in native byte order, a cache written on different architecture fails
+    magic check and is regenerated. Increase CACHE_VERSION on any layout change or
+    when new configuration fields affect generated primitives.
+*/
+static const uint32_t CACHE_MAGIC = 0x43474D50; // "PMGC"
+static const uint32_t CACHE_VERSION = 11;
+
+/**
+    @brief 64 bit FNV-1a hash used as cache key
+*/
+class CacheHash
+{
+public:
+    CacheHash() : m_Hash(14695981039346656037ull) {}
+
+    void Add(const void* Data, size_t Size);
+    void Add(double Value) { Add(&Value, sizeof(Value)); }
+    void Add(uint64_t Value) { Add(&Value, sizeof(Value)); }
+    void Add(bool Value) { Add((uint64_t)Value); }
+    void Add(const std::string& Value);
+    void Add(const Configuration::MaterialProps& Material);
+    void Add(const Configuration::record_filter_t& Filter);
+
+    uint64_t Get() const { return m_Hash; }
+
+private:
+    uint64_t m_Hash;
+};
+
+/**
+    @brief Cache key of PCB file data and configuration fields used to build primitives
+
+    Mesh parameters are not part of the key, mesh is generated from cached primitives.
+*/
+uint64_t CacheKey(const char* Begin, const char* End, const Configuration& Config);
+
+class CacheWriter
+{
+public:
+    CacheWriter(std::ostream& Stream) : m_Stream(Stream) {}
+
+    void Write(const void* Data, size_t Size) { m_Stream.write((const char*)Data, Size); }
+    void PutU32(uint32_t Value) { Write(&Value, sizeof(Value)); }
+    void PutU64(uint64_t Value) { Write(&Value, sizeof(Value)); }
+    void PutDouble(double Value) { Write(&Value, sizeof(Value)); }
+    // count followed by raw values, T must be trivially copyable
+    template <typename T> void PutArray(const std::vector<T>& Values)
+    {
+        PutU64(Values.size());
+        Write(Values.data(), Values.size() * sizeof(T));
+    }
+
+    bool Good() const { return m_Stream.good(); }
+
+private:
+    std::ostream& m_Stream;
+};
+
+class CacheReader
+{
+public:
+    CacheReader(std::istream& Stream) : m_Stream(Stream) {}
+
+    // all reads throw on truncated or corrupt data
+    void Read(void* Data, size_t Size);
+    uint32_t GetU32();
+    uint64_t GetU64();
+    double GetDouble();
+    template <typename T> void GetArray(std::vector<T>& Values)
+    {
+        uint64_t count = GetU64();
+        // read in chunks, so that corrupt count fails on end of file before allocating
+        const uint64_t chunk = 1 << 16;
+        Values.clear();
+        for (uint64_t done = 0; done < count;)
+        {
+            uint64_t n = count - done < chunk ? count - done : chunk;
+            Values.resize(done + n);
+            Read(Values.data() + done, n * sizeof(T));
+            done += n;
+        }
+    }
+
+private:
+    std::istream& m_Stream;
+};
+
+} // namespace pems
+} // namespace kicad_to_ems
+
+#endif // ems_cache_h
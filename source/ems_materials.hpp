@@ -0,0 +1,66 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ems_materials_h
+#define ems_materials_h
+
+#include "kicadtoems_config.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace kicad_to_ems
+{
+namespace pems
+{
+
+typedef uint8_t material_id_t;
+
+/**
+    @brief Materials of simulation box configuration addressed by small integer id
+
+    Primitives keep only the id, names and properties are looked up here when
+    model script or XML is written.
+*/
+class MaterialRegistry
+{
+public:
+    // ids are also stored in cache files, don't reorder
+    enum : material_id_t { PCB = 0, METAL_TOP, METAL_BOT, HOLE_FILL, BOX, COUNT };
+
+    explicit MaterialRegistry(Configuration& Config)
+    {
+        m_Materials[PCB] = &Config.SimulationBox.materials.pcb;
+        m_Materials[METAL_TOP] = &Config.SimulationBox.materials.metal_top;
+        m_Materials[METAL_BOT] = &Config.SimulationBox.materials.metal_bot;
+        m_Materials[HOLE_FILL] = &Config.SimulationBox.materials.hole_fill;
+        m_Materials[BOX] = &Config.SimulationBox.box_fill.box_material;
+    }
+
+    const Configuration::MaterialProps& Get(material_id_t Id) const { return *m_Materials[Id]; }
+    const std::string& GetName(material_id_t Id) const { return m_Materials[Id]->Name; }
+
+private:
+    Configuration::MaterialProps* m_Materials[COUNT];
+};
+
+} // namespace pems
+} // namespace kicad_to_ems
+
+#endif // ems_materials_h
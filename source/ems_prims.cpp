@@ -19,11 +19,16 @@
 
 #include "misc.hpp"
 #include "ems_prims.hpp"
+#include "ems_union.hpp"
 #include <iostream>
 #include <iomanip>
 #include <cassert>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <queue>
 
 using namespace kicad_to_ems;
 using namespace kicad_to_ems::pems;
@@ -34,137 +39,14 @@ namespace kicad_to_ems
 {
 namespace pems
 {
-void insert_arc(std::vector<std::complex<double>>& Points,
-                std::complex<double> Center,
-                std::complex<double> Start,
-                size_t Approx);
+std::complex<double>* insert_arc(std::complex<double>* Points,
+                                 std::complex<double> Center,
+                                 std::complex<double> Start,
+                                 size_t Approx);
 double round_to_n_digits(double x, size_t n);
 } // namespace pems
 } // namespace kicad_to_ems
 
-ExtrudedPolygon::ExtrudedPolygon(std::vector<std::complex<double>>& Outline,
-                                 double Z_Height,
-                                 double Thickness,
-                                 size_t Priority,
-                                 std::string& MaterialName)
-    : m_PolyOutline(Outline),
-      m_Z_Height(Z_Height),
-      m_Thickness(Thickness),
-      m_Priority(Priority),
-      m_MaterialName(MaterialName)
-{}
-
-std::string ExtrudedPolygon::GetCSX_Script()
-{
-    std::string str_points;
-    std::string str_full;
-    size_t points = m_PolyOutline.size();
-    if (points == 0)
-        return str_full;
-
-    complex<double> last_point = m_PolyOutline[0];
-
-    size_t p = 0;
-    for (size_t i = 0; i < points; ++i)
-    {
-        if (i > 0 && last_point == m_PolyOutline[i])
-            continue;
-        last_point = m_PolyOutline[i];
-
-        size_t str_len = snprintf(nullptr, 0, "p(1,%ld)=%.6f;p(2,%ld)=%.6f;\n", (p + 1),
-                                  m_PolyOutline[i].real(), (p + 1), m_PolyOutline[i].imag());
-        if (str_len <= 0)
-            throw 11;
-        str_len++;
-        char buffer[str_len];
-        snprintf(buffer, str_len, "p(1,%ld)=%.6f;p(2,%ld)=%.6f;\n", (p + 1),
-                 m_PolyOutline[i].real(), (p + 1), m_PolyOutline[i].imag());
-        str_points += buffer;
-        p++;
-    }
-
-    size_t str_len = snprintf(nullptr, 0, "p=zeros(2,%ld);\n", p);
-    if (str_len <= 0)
-        throw 11;
-    str_len++;
-    char buffer[str_len];
-    snprintf(buffer, str_len, "p=zeros(2,%ld);\n", p);
-    str_full += buffer;
-
-    str_full += str_points;
-
-    if (m_Thickness == 0)
-    {
-        size_t str_len = snprintf(nullptr, 0, "CSX = AddPolygon(CSX, '%s', %ld, 2, %.6f, p);\n",
-                                  m_MaterialName.c_str(), m_Priority, m_Z_Height);
-        if (str_len <= 0)
-            throw 11;
-        str_len++;
-        char buffer[str_len];
-        snprintf(buffer, str_len, "CSX = AddPolygon(CSX, '%s', %ld, 2, %.6f, p);\n",
-                 m_MaterialName.c_str(), m_Priority, m_Z_Height);
-        str_full += buffer;
-    }
-    else
-    {
-        size_t str_len =
-            snprintf(nullptr, 0, "CSX = AddLinPoly(CSX, '%s', %ld, 2, %.6f, p, %.6f);\n",
-                     m_MaterialName.c_str(), m_Priority, m_Z_Height, m_Thickness);
-        if (str_len <= 0)
-            throw 11;
-        str_len++;
-        char buffer[str_len];
-        snprintf(buffer, str_len, "CSX = AddLinPoly(CSX, '%s', %ld, 2, %.6f, p, %.6f);\n",
-                 m_MaterialName.c_str(), m_Priority, m_Z_Height, m_Thickness);
-        str_full += buffer;
-    }
-
-    return str_full;
-}
-
-void ExtrudedPolygon::GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& GetByMaterial)
-{
-    // insert only if materials match
-    if (GetByMaterial == m_MaterialName)
-    {
-        size_t points = m_PolyOutline.size();
-        if (points == 0)
-            return;
-
-        tinyxml2::XMLElement* lin_poly;
-        if (m_Thickness != 0)
-            lin_poly = InsertNode->GetDocument()->NewElement("LinPoly");
-        else
-            lin_poly = InsertNode->GetDocument()->NewElement("Polygon");
-        if (lin_poly == nullptr)
-            throw ems_exc("TinyXML2 Create NewElement() failed");
-        lin_poly->SetAttribute("Priority", (unsigned int)m_Priority);
-        lin_poly->SetAttribute("Elevation", m_Z_Height);
-        if (m_Thickness != 0)
-            lin_poly->SetAttribute("Length", m_Thickness);
-        lin_poly->SetAttribute("NormDir", 2);
-
-        complex<double> last_point = m_PolyOutline[0];
-
-        for (size_t i = 0; i < points; ++i)
-        {
-            if (i > 0 && last_point == m_PolyOutline[i])
-                continue;
-            last_point = m_PolyOutline[i];
-
-            tinyxml2::XMLElement* vertex = lin_poly->GetDocument()->NewElement("Vertex");
-            if (vertex == nullptr)
-                throw ems_exc("TinyXML2 Create NewElement() failed");
-
-            vertex->SetAttribute("X1", m_PolyOutline[i].real());
-            vertex->SetAttribute("X2", m_PolyOutline[i].imag());
-            lin_poly->InsertEndChild(vertex);
-        }
-
-        InsertNode->InsertEndChild(lin_poly);
-    }
-}
-
 Segment::Segment(std::complex<double>& P1,
                  std::complex<double>& P2,
                  double Z,
@@ -172,7 +54,9 @@ Segment::Segment(std::complex<double>& P1,
                  double T,
                  size_t Priority,
                  size_t Approx,
-                 Configuration::MaterialProps& Material)
+                 material_id_t Material,
+                 bool NativeBox,
+                 VertexArena& Arena)
 
     : m_Start(P1),
       m_End(P2),
@@ -181,38 +65,63 @@ Segment::Segment(std::complex<double>& P1,
       m_T(T),
       m_Priority(Priority),
       m_CornerApprox(Approx),
-      m_Material(Material)
+      m_Material(Material),
+      m_NativeBox(NativeBox)
 {
-    GenPolyOutline();
-    GenMeshLines();
+    GenPolyOutline(Arena);
 }
 
-std::string Segment::GetCSX_Script()
+void Segment::AddTo(PrimitiveStore& Store, std::complex<double> Offset) const
 {
-    ExtrudedPolygon polygon(m_PolyOutline, m_Z, m_T, m_Priority, m_Material.Name);
-    return polygon.GetCSX_Script();
+    Store.BeginObject();
+    AddPolygon(Store, Offset);
+    AddMeshLines(Store, Offset);
 }
 
-void Segment::GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& Material)
+void Segment::AddPolygon(PrimitiveStore& Store, std::complex<double> Offset) const
 {
-    ExtrudedPolygon polygon(m_PolyOutline, m_Z, m_T, m_Priority, m_Material.Name);
-    polygon.GetXML_Primitive(InsertNode, Material);
+    // square ended segment along x or y axis, mesh lines are the same box corners
+    std::complex<double> min, max;
+    if (m_NativeBox && m_CornerApprox == 0 &&
+        IsAxisAlignedBox(m_PolyOutline.Data, m_PolyOutline.Size, min, max))
+    {
+        Store.AddBox(min, max, m_Z, m_T, m_Priority, m_Material, Offset);
+        return;
+    }
+    Store.AddPolygon(m_PolyOutline.Data, m_PolyOutline.Size, m_Z, m_T, m_Priority, m_Material,
+                     Offset);
 }
 
-MeshLines Segment::GetMeshData() { return m_Mesh; }
-
-void Segment::GenMeshLines()
+void Segment::AddMeshLines(PrimitiveStore& Store, std::complex<double> Offset) const
 {
-    for (size_t i = 0; i < m_PolyOutline.size(); ++i)
+    for (size_t i = 0; i < m_PolyOutline.Size; ++i)
     {
-        m_Mesh.X.insert(round_to_n_digits(m_PolyOutline[i].real(), m_PrecisionDigits));
-        m_Mesh.Y.insert(round_to_n_digits(m_PolyOutline[i].imag(), m_PrecisionDigits));
+        std::complex<double> point = m_PolyOutline[i] + Offset;
+        Store.AddMeshLineX(round_to_n_digits(point.real(), m_PrecisionDigits));
+        Store.AddMeshLineY(round_to_n_digits(point.imag(), m_PrecisionDigits));
     }
-    m_Mesh.Z.insert(m_Z);
-    m_Mesh.Z.insert(m_Z + m_T);
+    Store.AddMeshLineZ(m_Z);
+    Store.AddMeshLineZ(m_Z + m_T);
+}
+
+void Segment::AddCylinder(PrimitiveStore& Store, std::complex<double> Offset) const
+{
+    Store.AddCylinder(m_Start, m_Width / 2.0, m_Z, m_T, m_Priority, m_Material, Offset);
 }
 
-void Segment::GenPolyOutline()
+void Segment::AddCylinderMeshLines(PrimitiveStore& Store, std::complex<double> Offset) const
+{
+    std::complex<double> center = m_Start + Offset;
+    double r = m_Width / 2.0;
+    Store.AddMeshLineX(round_to_n_digits(center.real() - r, m_PrecisionDigits));
+    Store.AddMeshLineX(round_to_n_digits(center.real() + r, m_PrecisionDigits));
+    Store.AddMeshLineY(round_to_n_digits(center.imag() - r, m_PrecisionDigits));
+    Store.AddMeshLineY(round_to_n_digits(center.imag() + r, m_PrecisionDigits));
+    Store.AddMeshLineZ(m_Z);
+    Store.AddMeshLineZ(m_Z + m_T);
+}
+
+void Segment::GenPolyOutline(VertexArena& Arena)
 {
     complex<double> nvect;
     if (m_Start == m_End)
@@ -224,15 +133,18 @@ void Segment::GenPolyOutline()
         nvect = (m_End - m_Start) / abs(m_End - m_Start);
     }
 
-    complex<double> nleft = rot_vector(nvect, -M_PI_2);
-    complex<double> nright = rot_vector(nvect, +M_PI_2);
+    complex<double> nleft = rot_minus_90(nvect);
+    complex<double> nright = rot_plus_90(nvect);
     complex<double> end_point = m_End;
     complex<double> point = m_Start;
 
-    insert_arc(m_PolyOutline, m_Start, nright * m_Width / 2.0, m_CornerApprox);
-    insert_arc(m_PolyOutline, end_point, nleft * m_Width / 2.0, m_CornerApprox);
+    // two arcs of Approx + 2 points and closing point
+    m_PolyOutline = Arena.Allocate(2 * (m_CornerApprox + 2) + 1);
+    std::complex<double>* it = m_PolyOutline.Data;
+    it = insert_arc(it, m_Start, nright * m_Width / 2.0, m_CornerApprox);
+    it = insert_arc(it, end_point, nleft * m_Width / 2.0, m_CornerApprox);
     point += nright * m_Width / 2.0;
-    m_PolyOutline.push_back(point);
+    *it = point;
 }
 
 Via::Via(std::complex<double>& P1,
@@ -243,65 +155,71 @@ Via::Via(std::complex<double>& P1,
          size_t Priority,
          size_t Approx,
          double WMill,
-         Configuration::MaterialProps& MaterialRing,
-         Configuration::MaterialProps& MaterialHole)
+         material_id_t MaterialRing,
+         material_id_t MaterialHole,
+         bool NativeCylinders,
+         VertexArena& Arena)
 
     : m_DrillSize(WMill),
       m_MetalSize(W),
-      m_Cilinder(P1, P2, Z, W, T, Priority, (Approx == 0 ? 1 : Approx), MaterialRing),
-      m_Mill(P1, P2, Z, WMill, T, Priority + 1, (Approx == 0 ? 1 : Approx), MaterialHole)
+      m_Native(NativeCylinders && P1 == P2 && T != 0),
+      m_Cilinder(P1, P2, Z, W, T, Priority, (Approx == 0 ? 1 : Approx), MaterialRing, false,
+                 Arena),
+      m_Mill(P1, P2, Z, WMill, T, Priority + 1, (Approx == 0 ? 1 : Approx), MaterialHole, false,
+             Arena)
 {}
 
-std::string Via::GetCSX_Script()
+void Via::AddTo(PrimitiveStore& Store, std::complex<double> Offset) const
 {
-    if (m_DrillSize >= m_MetalSize)
+    // ring is covered by drill if it is not larger, mesh lines of both are used
+    Store.BeginObject();
+    if (m_Native)
     {
-        return m_Mill.GetCSX_Script();
+        if (m_DrillSize < m_MetalSize)
+            m_Cilinder.AddCylinder(Store, Offset);
+        m_Mill.AddCylinder(Store, Offset);
+        m_Cilinder.AddCylinderMeshLines(Store, Offset);
+        m_Mill.AddCylinderMeshLines(Store, Offset);
+        return;
     }
-    return m_Cilinder.GetCSX_Script() + m_Mill.GetCSX_Script();
-}
-
-MeshLines Via::GetMeshData()
-{
-    MeshLines mesh = m_Cilinder.GetMeshData();
-    MeshLines mesh_mill = m_Mill.GetMeshData();
-
-    mesh.X.insert(mesh_mill.X.begin(), mesh_mill.X.end());
-    mesh.Y.insert(mesh_mill.Y.begin(), mesh_mill.Y.end());
-    mesh.Z.insert(mesh_mill.Z.begin(), mesh_mill.Z.end());
-
-    return mesh;
-}
-
-void Via::GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& Material)
-{
-    m_Mill.GetXML_Primitive(InsertNode, Material);
-
     if (m_DrillSize < m_MetalSize)
-    {
-        m_Cilinder.GetXML_Primitive(InsertNode, Material);
-    }
+        m_Cilinder.AddPolygon(Store, Offset);
+    m_Mill.AddPolygon(Store, Offset);
+    m_Cilinder.AddMeshLines(Store, Offset);
+    m_Mill.AddMeshLines(Store, Offset);
 }
 
-Zone::Zone(std::vector<std::complex<double>>& OutlineCenterPts,
+Zone::Zone(const std::vector<std::complex<double>>& OutlineCenterPts,
            double Z,
            double W,
            double T,
            size_t Priority,
            size_t Approx,
-           Configuration::MaterialProps& Material,
-           bool OutlineIsCenter)
+           const MaterialRegistry& Materials,
+           material_id_t Material,
+           bool OutlineIsCenter,
+           bool NativeBox,
+           VertexArena& Arena)
 
-    : m_Z(Z), m_T(T), m_Priority(Priority), m_Approx(Approx), m_Material(Material)
+    : m_Z(Z),
+      m_T(T),
+      m_Priority(Priority),
+      m_Approx(Approx),
+      m_Material(Material),
+      m_IsBox(false),
+      m_OneThirdRule(Materials.Get(Material).boundary_one_third_rule),
+      m_BoundaryLines(Materials.Get(Material).boundary_additional_lines),
+      m_RuleDistance(Materials.Get(Material).boundary_rule_distance)
 {
 
     if (OutlineCenterPts.size() < 3)
         return;
 
-    std::vector<std::complex<double>> outline_center = OutlineCenterPts;
+    VertexSpan outline_center = Arena.Copy(OutlineCenterPts.data(), OutlineCenterPts.size());
+    size_t count = outline_center.Size;
 
     // get winding order (clockwise or counterclockwise)
-    bool is_clkwise = IsClockWiseOrder(outline_center);
+    bool is_clkwise = IsClockWiseOrder(outline_center.Data, count);
     if (!is_clkwise)
     {
         std::reverse(outline_center.begin(), outline_center.end());
@@ -312,113 +230,155 @@ Zone::Zone(std::vector<std::complex<double>>& OutlineCenterPts,
     // smaller polygons around the center zone.
     // This is because KiCAD zones outline is stored as center of draw tool and
     // openEMS doesn't allow self intersecting polygons.
-    std::vector<std::complex<double>>::iterator prev;
-    std::vector<std::complex<double>>::iterator center;
-    std::vector<std::complex<double>>::iterator next;
-    for (size_t i = 0, index = 2; i < outline_center.size(); ++i, ++index)
+    m_RealOutline = Arena.Allocate(count);
+    m_InnerOutline = Arena.Allocate(count);
+    std::complex<double>* prev;
+    std::complex<double>* center;
+    std::complex<double>* next;
+    for (size_t i = 0, index = 2; i < count; ++i, ++index)
     {
         next = outline_center.begin() +
-               (index >= outline_center.size() ? index - outline_center.size() : index);
+               (index >= count ? index - count : index);
         center =
             outline_center.begin() +
-            (index - 1 >= outline_center.size() ? index - 1 - outline_center.size() : index - 1);
+            (index - 1 >= count ? index - 1 - count : index - 1);
         prev = outline_center.begin() +
-               (index - 2 >= outline_center.size() ? index - 2 - outline_center.size() : index - 2);
+               (index - 2 >= count ? index - 2 - count : index - 2);
 
         // first line data
         std::complex<double> line_first = *center - *prev;
         std::complex<double> vnorm_first = line_first / abs(line_first);
-        std::complex<double> vnorm_right_first = rot_vector(vnorm_first, -M_PI_2);
+        std::complex<double> vnorm_right_first = rot_minus_90(vnorm_first);
 
         // second line data
         std::complex<double> line_second = *next - *center;
         std::complex<double> vnorm_second = line_second / abs(line_second);
-        std::complex<double> vnorm_right_second = rot_vector(vnorm_second, -M_PI_2);
+        std::complex<double> vnorm_right_second = rot_minus_90(vnorm_second);
 
         std::complex<double> voffset_right = vnorm_right_first * (OutlineIsCenter ? 0.0 : 0.001);
         std::complex<double> voffset_left = -vnorm_right_first * (W / 2.0);
 
-        double angle = getVectAngle(vnorm_right_first, vnorm_right_second);
-        double offset_right_mag = abs(voffset_right) / cos(angle / 2);
-        double offset_left_mag = abs(voffset_left) / cos(angle / 2);
+        // cos of half angle between normals from cos of angle (dot product of unit vectors)
+        double cos_angle = vnorm_right_first.real() * vnorm_right_second.real() +
+                           vnorm_right_first.imag() * vnorm_right_second.imag();
+        cos_angle = std::max(-1.0, std::min(1.0, cos_angle));
+        double cos_half = sqrt((1 + cos_angle) / 2);
+        double offset_right_mag = abs(voffset_right) / cos_half;
+        double offset_left_mag = abs(voffset_left) / cos_half;
+
+        // new points are on bisector of the two normals
+        std::complex<double> bisector = vnorm_right_first + vnorm_right_second;
+        double bisector_len = abs(bisector);
+        if (bisector_len > 0)
+            bisector /= bisector_len;
+        else
+            bisector = 1;
+        std::complex<double> vect_new_point_right = bisector * offset_right_mag;
+        std::complex<double> vect_new_point_left = -bisector * offset_left_mag;
+
+        m_RealOutline[i] = *center + vect_new_point_left;
+        m_InnerOutline[i] = *center + vect_new_point_right;
+    }
 
-        std::complex<double> vect_new_point_right =
-            std::polar(offset_right_mag, std::arg(vnorm_right_first + vnorm_right_second));
-        std::complex<double> vect_new_point_left =
-            std::polar(offset_left_mag, std::arg(vnorm_right_first + vnorm_right_second) - M_PI);
+    // mitered offset of rectangle is a rectangle too, its rounded corners are dropped
+    std::complex<double> min, max;
+    if (NativeBox && IsAxisAlignedBox(outline_center.Data, count, min, max))
+    {
+        m_IsBox = true;
+        return;
+    }
 
-        m_RealOutline.push_back(*center + vect_new_point_left);
-        m_InnerOutline.push_back(*center + vect_new_point_right);
+    // whole zone as one polygon, border polygons are only used if offset outline of the
+    // zone can't be resolved
+    std::vector<std::complex<double>> outline;
+    PolygonOffset offset(PolygonOffset::JOIN_ROUND, Approx + 1);
+    if (offset.Run(outline_center.Data, count, W / 2.0, outline))
+    {
+        m_Outline = Arena.Copy(outline.data(), outline.size());
+        return;
     }
 
-    for (size_t i = 1; i < outline_center.size() + 1; ++i)
+    // corner lines of neighboring border polygons that cross, all but the closing pair are
+    // tested in one batch
+    std::unique_ptr<bool[]> crossed(new bool[count]);
+    pems::Misc::lines_intersect(m_RealOutline.Data + 1, m_InnerOutline.Data + 1,
+                                m_RealOutline.Data, m_InnerOutline.Data, count - 1,
+                                crossed.get());
+    crossed[count - 1] = pems::Misc::lines_intersect(m_RealOutline[0], m_InnerOutline[0],
+                                                     m_RealOutline[count - 1],
+                                                     m_InnerOutline[count - 1]);
+
+    m_OutlinePolys = Arena.Allocate(4 * count);
+    for (size_t i = 1; i < count + 1; ++i)
     {
-        std::vector<std::complex<double>> points;
+        std::complex<double>* points = m_OutlinePolys.Data + 4 * (i - 1);
 
-        points.push_back(m_RealOutline[i >= outline_center.size() ? 0 : i]);
+        points[0] = m_RealOutline[i >= count ? 0 : i];
 
         // if lines intersect switch order
-        if (pems::Misc::lines_intersect(m_RealOutline[i >= outline_center.size() ? 0 : i],
-                                        m_InnerOutline[i >= outline_center.size() ? 0 : i],
-                                        m_RealOutline[i - 1], m_InnerOutline[i - 1]))
+        if (crossed[i - 1])
         {
-            points.push_back(m_InnerOutline[i - 1]);
-            points.push_back(m_InnerOutline[i >= outline_center.size() ? 0 : i]);
+            points[1] = m_InnerOutline[i - 1];
+            points[2] = m_InnerOutline[i >= count ? 0 : i];
         }
         else
         {
-            points.push_back(m_InnerOutline[i >= outline_center.size() ? 0 : i]);
-            points.push_back(m_InnerOutline[i - 1]);
+            points[1] = m_InnerOutline[i >= count ? 0 : i];
+            points[2] = m_InnerOutline[i - 1];
         }
 
-        points.push_back(m_RealOutline[i - 1]);
-
-        ExtrudedPolygon polygon(points, m_Z, m_T, m_Priority, m_Material.Name);
-        m_OutlinePolys.push_back(polygon);
+        points[3] = m_RealOutline[i - 1];
     }
 }
 
-std::string Zone::GetCSX_Script()
+void Zone::AddTo(PrimitiveStore& Store) const
 {
-    std::string segment_blocks;
-
-    for (size_t i = 0; i < m_OutlinePolys.size(); i++)
+    if (m_IsBox)
     {
-        segment_blocks += m_OutlinePolys[i].GetCSX_Script();
+        BoundingBox box = BoundingBox::Of(m_RealOutline.Data, m_RealOutline.Size);
+        Store.BeginObject();
+        Store.AddBox(std::complex<double>(box.MinX, box.MinY),
+                     std::complex<double>(box.MaxX, box.MaxY), m_Z, m_T, m_Priority, m_Material);
+        AddMeshLines(Store);
+        return;
     }
-    ExtrudedPolygon polygon(m_InnerOutline, m_Z, m_T, m_Priority, m_Material.Name);
-
-    return segment_blocks + polygon.GetCSX_Script();
-}
-
-void Zone::GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& Material)
-{
-    ExtrudedPolygon polygon(m_InnerOutline, m_Z, m_T, m_Priority, m_Material.Name);
-    polygon.GetXML_Primitive(InsertNode, Material);
 
-    for (size_t i = 0; i < m_OutlinePolys.size(); i++)
+    if (m_Outline.Size > 0)
     {
-        m_OutlinePolys[i].GetXML_Primitive(InsertNode, Material);
+        Store.BeginObject();
+        Store.AddPolygon(m_Outline.Data, m_Outline.Size, m_Z, m_T, m_Priority, m_Material);
+        AddMeshLines(Store);
+        return;
     }
+
+    // border polygons first, zone body last
+    Store.BeginObject();
+    for (size_t i = 0; i + 4 <= m_OutlinePolys.Size; i += 4)
+        Store.AddPolygon(m_OutlinePolys.Data + i, 4, m_Z, m_T, m_Priority, m_Material);
+    Store.AddPolygon(m_InnerOutline.Data, m_InnerOutline.Size, m_Z, m_T, m_Priority, m_Material);
+    AddMeshLines(Store);
 }
 
-MeshLines Zone::GetMeshData()
+void Zone::AddMeshLines(PrimitiveStore& Store) const
 {
-    MeshLines mesh;
+    bool one_third_rule = m_OneThirdRule;
+    bool boundary_lines = m_BoundaryLines;
+    double rule_distance = m_RuleDistance;
 
-    bool one_third_rule = m_Material.boundary_one_third_rule;
-    bool boundary_lines = m_Material.boundary_additional_lines;
-    double rule_distance = m_Material.boundary_rule_distance;
+    // lines follow the emitted outline, the mitered one is only emitted for boxes and by
+    // the border polygon fallback; one third rule sides assume a clockwise outline
+    const VertexSpan& outline = m_Outline.Size > 0 ? m_Outline : m_RealOutline;
+    bool is_clkwise = m_Outline.Size == 0 || IsClockWiseOrder(outline.Data, outline.Size);
 
-    for (size_t i = 1; i < m_RealOutline.size() + 1; i++)
+    for (size_t i = 1; i < outline.Size + 1; i++)
     {
         size_t index = i;
         size_t prev_index = i - 1;
-        if (index >= m_RealOutline.size())
-            index -= m_RealOutline.size();
-        if (prev_index >= m_RealOutline.size())
-            prev_index -= m_RealOutline.size();
-        std::complex<double> line = m_RealOutline[index] - m_RealOutline[prev_index];
+        if (index >= outline.Size)
+            index -= outline.Size;
+        if (prev_index >= outline.Size)
+            prev_index -= outline.Size;
+        std::complex<double> line = outline[index] - outline[prev_index];
         double angle = std::arg(line);
         double abs_angle = std::fabs(angle);
         double e = 0.01745; // ~1deg
@@ -426,136 +386,274 @@ MeshLines Zone::GetMeshData()
         if (abs_angle < M_PI_2 + e && abs_angle > M_PI_2 - e)
         {
             // vertical
-            bool up = angle > 0 ? true : false;
+            bool up = (angle > 0) == is_clkwise;
 
             if (one_third_rule)
             {
                 if (up)
                 {
-                    mesh.X.insert(m_RealOutline[index].real() + rule_distance * 0.333);
-                    mesh.X.insert(m_RealOutline[index].real() - rule_distance * 0.667);
+                    Store.AddMeshLineX(outline[index].real() + rule_distance * 0.333);
+                    Store.AddMeshLineX(outline[index].real() - rule_distance * 0.667);
                 }
                 else
                 {
-                    mesh.X.insert(m_RealOutline[index].real() - rule_distance * 0.333);
-                    mesh.X.insert(m_RealOutline[index].real() + rule_distance * 0.667);
+                    Store.AddMeshLineX(outline[index].real() - rule_distance * 0.333);
+                    Store.AddMeshLineX(outline[index].real() + rule_distance * 0.667);
                 }
             }
             else
             {
-                mesh.X.insert(m_RealOutline[index].real());
+                Store.AddMeshLineX(outline[index].real());
                 if (boundary_lines)
                 {
-                    mesh.X.insert(m_RealOutline[index].real() - rule_distance);
-                    mesh.X.insert(m_RealOutline[index].real() + rule_distance);
+                    Store.AddMeshLineX(outline[index].real() - rule_distance);
+                    Store.AddMeshLineX(outline[index].real() + rule_distance);
                 }
             }
         }
         else if (abs_angle < e || abs_angle > M_PI - e)
         {
             // horizontal
-            bool fwd = abs_angle < e ? true : false;
+            bool fwd = (abs_angle < e) == is_clkwise;
 
             if (one_third_rule)
             {
                 if (fwd)
                 {
-                    mesh.Y.insert(m_RealOutline[index].imag() - rule_distance * 0.333);
-                    mesh.Y.insert(m_RealOutline[index].imag() + rule_distance * 0.667);
+                    Store.AddMeshLineY(outline[index].imag() - rule_distance * 0.333);
+                    Store.AddMeshLineY(outline[index].imag() + rule_distance * 0.667);
                 }
                 else
                 {
-                    mesh.Y.insert(m_RealOutline[index].imag() + rule_distance * 0.333);
-                    mesh.Y.insert(m_RealOutline[index].imag() - rule_distance * 0.667);
+                    Store.AddMeshLineY(outline[index].imag() + rule_distance * 0.333);
+                    Store.AddMeshLineY(outline[index].imag() - rule_distance * 0.667);
                 }
             }
             else
             {
-                mesh.Y.insert(m_RealOutline[index].imag());
+                Store.AddMeshLineY(outline[index].imag());
                 if (boundary_lines)
                 {
-                    mesh.Y.insert(m_RealOutline[index].imag() - rule_distance);
-                    mesh.Y.insert(m_RealOutline[index].imag() + rule_distance);
+                    Store.AddMeshLineY(outline[index].imag() - rule_distance);
+                    Store.AddMeshLineY(outline[index].imag() + rule_distance);
                 }
             }
         }
     }
 
-    mesh.Z.insert(m_Z);
+    Store.AddMeshLineZ(m_Z);
     if (m_T != 0)
     {
-        mesh.Z.insert(m_Z + m_T);
+        Store.AddMeshLineZ(m_Z + m_T);
     }
-
-    return mesh;
 }
 
 void Zone::ApproximatePolygon(std::vector<std::complex<double>>& Points, double MaxError)
 {
-    for (size_t i = 2; i < Points.size();)
+    size_t count = Points.size();
+    if (count <= 3 || !(MaxError > 0))
+        return;
+
+    // points repeated at same location are ends of zone fill bridges, they are kept so
+    // that bridges stay closed
+    std::vector<bool> keep(count, false);
+    std::vector<bool> removed(count, false);
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&Points](size_t A, size_t B) {
+        return Points[A].real() < Points[B].real() ||
+               (Points[A].real() == Points[B].real() && Points[A].imag() < Points[B].imag());
+    });
+    for (size_t k = 1; k < count; ++k)
+    {
+        if (Points[order[k]] == Points[order[k - 1]])
+            keep[order[k]] = keep[order[k - 1]] = true;
+    }
+
+    // points are removed smallest deviation first from a linked ring. Deviation of point
+    // is its distance from the edge joining its neighbors plus the larger error of its two
+    // edges, error of edge is the largest distance of removed points from it.
+    std::vector<size_t> prev(count), next(count);
+    std::vector<double> edge_error(count, 0);
+    std::vector<double> cost(count);
+    for (size_t i = 0; i < count; ++i)
     {
-        std::complex<double> line_a = Points[i - 1] - Points[i - 2];
-        std::complex<double> line_b = Points[i] - Points[i - 2];
-        double angle_diff = getVectAngle(line_a, line_b);
-        double error = fabs(sin(angle_diff) * fabs(line_a));
-        if (error < MaxError)
+        prev[i] = i == 0 ? count - 1 : i - 1;
+        next[i] = i + 1 < count ? i + 1 : 0;
+    }
+    auto deviation = [&](size_t I) {
+        std::complex<double> a = Points[prev[I]];
+        std::complex<double> d = Points[next[I]] - a;
+        std::complex<double> p = Points[I] - a;
+        double len = std::norm(d);
+        double t = len > 0 ? (p.real() * d.real() + p.imag() * d.imag()) / len : 0;
+        t = std::max(0.0, std::min(1.0, t));
+        return std::abs(p - d * t) + std::max(edge_error[prev[I]], edge_error[I]);
+    };
+
+    // removing a point replaces its two edges with one. As the outline is simple, other
+    // edges can only cross the new edge if one of their vertices lies in the triangle of
+    // the point and its neighbors, such points are not removed until their neighbors change
+    std::vector<BoundingBox> boxes(count);
+    for (size_t i = 0; i < count; ++i)
+        boxes[i] = BoundingBox::Of(&Points[i], 1);
+    BoxTree vertices;
+    vertices.Build(boxes);
+    std::vector<uint32_t> near;
+    auto crossing = [&](size_t I) {
+        std::complex<double> triangle[3] = {Points[prev[I]], Points[I], Points[next[I]]};
+        double area = Misc::orient(triangle[0], triangle[1], triangle[2]);
+        near.clear();
+        vertices.Query(BoundingBox::Of(triangle, 3), near);
+        for (size_t k = 0; k < near.size(); ++k)
         {
-            // erase center point if error in allowed range
-            Points.erase(Points.begin() + i - 1);
+            size_t v = near[k];
+            std::complex<double> q = Points[v];
+            // bridge ends touch the new edge only at its ends
+            if (removed[v] || v == I || q == triangle[0] || q == triangle[2])
+                continue;
+            double s0 = Misc::orient(triangle[0], triangle[1], q);
+            double s1 = Misc::orient(triangle[1], triangle[2], q);
+            double s2 = Misc::orient(triangle[2], triangle[0], q);
+            if (area >= 0 ? (s0 >= 0 && s1 >= 0 && s2 >= 0) : (s0 <= 0 && s1 <= 0 && s2 <= 0))
+                return true;
         }
-        else
+        return false;
+    };
+
+    typedef std::pair<double, size_t> entry_t;
+    std::priority_queue<entry_t, std::vector<entry_t>, std::greater<entry_t>> heap;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (keep[i])
+            continue;
+        cost[i] = deviation(i);
+        heap.push(entry_t(cost[i], i));
+    }
+
+    size_t left = count;
+    while (!heap.empty() && left > 3)
+    {
+        entry_t top = heap.top();
+        heap.pop();
+        size_t i = top.second;
+        // stale entry of point whose neighbors changed
+        if (removed[i] || top.first != cost[i])
+            continue;
+        if (top.first > MaxError)
+            break;
+        if (crossing(i))
+            continue;
+
+        size_t p = prev[i];
+        size_t n = next[i];
+        edge_error[p] = top.first;
+        next[p] = n;
+        prev[n] = p;
+        removed[i] = true;
+        left--;
+
+        for (size_t j : {p, n})
         {
-            ++i;
+            if (keep[j])
+                continue;
+            cost[j] = deviation(j);
+            heap.push(entry_t(cost[j], j));
         }
     }
-}
 
-double Zone::getVectAngle(std::complex<double> U, std::complex<double> V)
-{
-    double dot_prod = U.real() * V.real() + U.imag() * V.imag();
-    double mag_prod = abs(U) * abs(V);
-    double angle = 0;
-
-    if (dot_prod / mag_prod <= -1.0) {
-        angle = M_PI;
-    } else if (dot_prod / mag_prod >= 1.0) {
-        angle = 0;
-    } else {
-        // acos(x) returns NaN when input outside of -1 <= x <= 1
-        // this is not guaranteed when using floats
-        angle = acos(dot_prod / mag_prod);
+    size_t out = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!removed[i])
+            Points[out++] = Points[i];
     }
-    
-    return angle;
+    Points.resize(out);
 }
 
-void pems::insert_arc(std::vector<std::complex<double>>& Points,
-                      std::complex<double> Center,
-                      std::complex<double> Start,
-                      size_t Approx)
+// unit vectors of half circle split into Approx + 1 steps, one table per approximation
+// and thread
+static const std::vector<std::complex<double>>& arc_table(size_t Approx)
 {
-    complex<double> arc_vect = Start;
-    Points.push_back(Center + Start);
+    thread_local std::vector<std::vector<std::complex<double>>> tables;
+    if (Approx >= tables.size())
+        tables.resize(Approx + 1);
 
-    size_t insert_points = Approx + 1;
-    for (size_t i = 0; i < insert_points; i++)
+    std::vector<std::complex<double>>& table = tables[Approx];
+    if (table.empty())
     {
-        arc_vect = rot_vector(arc_vect, M_PI / insert_points);
-        Points.push_back(Center + arc_vect);
+        size_t steps = Approx + 1;
+        for (size_t i = 0; i <= steps; i++)
+        {
+            double angle = M_PI * i / steps;
+            table.push_back(std::complex<double>(cos(angle), sin(angle)));
+        }
     }
+    return table;
+}
+
+// writes Approx + 2 points, returns end of written points
+std::complex<double>* pems::insert_arc(std::complex<double>* Points,
+                                       std::complex<double> Center,
+                                       std::complex<double> Start,
+                                       size_t Approx)
+{
+    const std::vector<std::complex<double>>& table = arc_table(Approx);
+    const std::complex<double>* unit = table.data();
+    size_t count = table.size();
+
+    for (size_t i = 0; i < count; i++)
+        Points[i] = Center + rot_unit(Start, unit[i]);
+    return Points + count;
 }
 
 std::complex<double> pems::rot_vector(std::complex<double> Vect, double RotAngle)
 {
-    return std::polar(abs(Vect), arg(Vect) + RotAngle);
+    return rot_unit(Vect, std::complex<double>(cos(RotAngle), sin(RotAngle)));
+}
+
+Affine2D Affine2D::Rotation(double RotAngle)
+{
+    double cos_a = cos(RotAngle);
+    double sin_a = sin(RotAngle);
+    return Affine2D{cos_a, -sin_a, sin_a, cos_a, 0, 0};
+}
+
+Affine2D Affine2D::Translation(std::complex<double> Offset)
+{
+    return Affine2D{1, 0, 0, 1, Offset.real(), Offset.imag()};
+}
+
+Affine2D Affine2D::Then(const Affine2D& Next) const
+{
+    return Affine2D{Next.a * a + Next.b * c,
+                    Next.a * b + Next.b * d,
+                    Next.c * a + Next.d * c,
+                    Next.c * b + Next.d * d,
+                    Next.a * tx + Next.b * ty + Next.tx,
+                    Next.c * tx + Next.d * ty + Next.ty};
 }
 
-bool pems::IsClockWiseOrder(std::vector<std::complex<double>>& Data)
+void Affine2D::Apply(std::complex<double>* Points, size_t Count) const
+{
+    // complex<double> is stored as two doubles, plain loop over them vectorizes
+    double* p = reinterpret_cast<double*>(Points);
+    for (size_t i = 0; i < 2 * Count; i += 2)
+    {
+        double x = p[i];
+        double y = p[i + 1];
+        p[i] = a * x + b * y + tx;
+        p[i + 1] = c * x + d * y + ty;
+    }
+}
+
+bool pems::IsClockWiseOrder(const std::complex<double>* Data, size_t Size)
 {
     double sum = 0;
-    for (size_t i = 0; i < Data.size(); i++)
+    for (size_t i = 0; i < Size; i++)
     {
-        if (i + 1 == Data.size())
+        if (i + 1 == Size)
         {
             sum += (Data[0].real() - Data[i].real()) * (Data[0].imag() + Data[i].imag());
         }
@@ -567,6 +665,39 @@ bool pems::IsClockWiseOrder(std::vector<std::complex<double>>& Data)
     return sum > 0;
 }
 
+bool pems::IsAxisAlignedBox(const std::complex<double>* Data,
+                            size_t Size,
+                            std::complex<double>& Min,
+                            std::complex<double>& Max)
+{
+    // far below coordinate resolution of KiCad, covers rounding of 90 degree rotations
+    const double eps = 1e-9;
+    if (Size < 4)
+        return false;
+
+    BoundingBox box = BoundingBox::Of(Data, Size);
+    double area = 0;
+    for (size_t i = 0; i < Size; i++)
+    {
+        std::complex<double> a = Data[i];
+        std::complex<double> b = Data[i + 1 < Size ? i + 1 : 0];
+        if (std::fabs(b.real() - a.real()) > eps && std::fabs(b.imag() - a.imag()) > eps)
+            return false;
+        area += a.real() * b.imag() - b.real() * a.imag();
+    }
+
+    // axis aligned outline enclosing its whole bounding box once is that box
+    double width = box.MaxX - box.MinX;
+    double height = box.MaxY - box.MinY;
+    if (width <= eps || height <= eps ||
+        std::fabs(std::fabs(area / 2) - width * height) > eps * (width + height))
+        return false;
+
+    Min = std::complex<double>(box.MinX, box.MinY);
+    Max = std::complex<double>(box.MaxX, box.MaxY);
+    return true;
+}
+
 double pems::round_to_n_digits(double x, size_t n)
 {
     double factor = pow(10.0, n);
@@ -575,4 +706,21 @@ double pems::round_to_n_digits(double x, size_t n)
 
 double pems::deg_to_radian(double degrees) { return degrees * M_PI / 180; }
 
+// bounds arc tables of tolerance based approximation
+static const size_t MAX_ARC_STEPS = 256;
+
+size_t pems::arc_approximation(double Radius, double Tolerance, size_t Approx)
+{
+    if (!(Tolerance > 0))
+        return Approx;
+    if (!(Radius > Tolerance))
+        return 0;
+
+    // chord of angle a is r * (1 - cos(a / 2)) away from arc, half circle takes
+    // Approx + 1 chords
+    double max_angle = 2 * acos(1 - Tolerance / Radius);
+    size_t steps = (size_t)ceil(M_PI / max_angle);
+    return std::min(steps, MAX_ARC_STEPS) - 1;
+}
+
 //
@@ -22,6 +22,8 @@
 
 #include "srecs.hpp"
 #include "kicadtoems_config.hpp"
+#include "ems_store.hpp"
+#include "ems_arena.hpp"
 
 #include <tinyxml2.h>
 #include <complex>
@@ -46,36 +48,63 @@ public:
 #endif
 
 double deg_to_radian(double degrees);
+// corner approximation of arc with Radius, so that chords are at most Tolerance away from
+// the arc; Approx if Tolerance is 0
+size_t arc_approximation(double Radius, double Tolerance, size_t Approx);
 std::complex<double> rot_vector(std::complex<double> Vect, double RotAngle);
-bool IsClockWiseOrder(std::vector<std::complex<double>>& Data);
 
-struct Line {
-    std::complex<double> m_Start;
-    std::complex<double> m_End;
-};
+// rotate by unit vector Rot = (cos, sin), plain multiply-add without the NaN handling of
+// std::complex operator*
+inline std::complex<double> rot_unit(std::complex<double> Vect, std::complex<double> Rot)
+{
+    return std::complex<double>(Vect.real() * Rot.real() - Vect.imag() * Rot.imag(),
+                                Vect.real() * Rot.imag() + Vect.imag() * Rot.real());
+}
 
-struct MeshLines {
-    std::set<double> X;
-    std::set<double> Y;
-    std::set<double> Z;
+// exact rotation by -90 and +90 degrees
+inline std::complex<double> rot_minus_90(std::complex<double> Vect)
+{
+    return std::complex<double>(Vect.imag(), -Vect.real());
+}
+inline std::complex<double> rot_plus_90(std::complex<double> Vect)
+{
+    return std::complex<double>(-Vect.imag(), Vect.real());
+}
+
+/**
+    @brief 2x3 affine transform of plane points
+
+    x' = a * x + b * y + tx
+    y' = c * x + d * y + ty
+*/
+struct Affine2D {
+    double a, b, c, d, tx, ty;
+
+    static Affine2D Rotation(double RotAngle);
+    static Affine2D Translation(std::complex<double> Offset);
+
+    // transform doing this one first, then Next
+    Affine2D Then(const Affine2D& Next) const;
+
+    std::complex<double> Apply(std::complex<double> Point) const
+    {
+        return std::complex<double>(a * Point.real() + b * Point.imag() + tx,
+                                    c * Point.real() + d * Point.imag() + ty);
+    }
+    // transform Count points in place
+    void Apply(std::complex<double>* Points, size_t Count) const;
 };
 
-class ExtrudedPolygon
-{
-    std::vector<std::complex<double>> m_PolyOutline;
-    double m_Z_Height;
-    double m_Thickness;
-    size_t m_Priority;
-    std::string m_MaterialName;
+bool IsClockWiseOrder(const std::complex<double>* Data, size_t Size);
+// outline is an axis aligned rectangle with nonzero area, Min and Max are its corners
+bool IsAxisAlignedBox(const std::complex<double>* Data,
+                      size_t Size,
+                      std::complex<double>& Min,
+                      std::complex<double>& Max);
 
-public:
-    ExtrudedPolygon(std::vector<std::complex<double>>& Outline,
-                    double Z_Height,
-                    double Thickness,
-                    size_t Priority,
-                    std::string& MaterialName);
-    std::string GetCSX_Script();
-    void GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& GetByMaterial);
+struct Line {
+    std::complex<double> m_Start;
+    std::complex<double> m_End;
 };
 
 class Segment
@@ -88,13 +117,13 @@ private:
     double m_T;
     size_t m_Priority;
     size_t m_CornerApprox;
-    Configuration::MaterialProps m_Material;
+    material_id_t m_Material;
+    // axis aligned rectangular outline is emitted as box
+    bool m_NativeBox;
     const size_t m_PrecisionDigits = 6;
-    MeshLines m_Mesh;
-    std::vector<std::complex<double>> m_PolyOutline;
+    VertexSpan m_PolyOutline;
 
-    void GenMeshLines();
-    void GenPolyOutline();
+    void GenPolyOutline(VertexArena& Arena);
 
 public:
     Segment(std::complex<double>& P1,
@@ -104,17 +133,28 @@ public:
             double T,
             size_t Priority,
             size_t Approx,
-            Configuration::MaterialProps& Material);
-
-    std::string GetCSX_Script();
-    MeshLines GetMeshData();
-    void GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& Material);
+            material_id_t Material,
+            bool NativeBox,
+            VertexArena& Arena);
+
+    // add segment moved by Offset to store as one object
+    void AddTo(PrimitiveStore& Store, std::complex<double> Offset = 0) const;
+    void AddPolygon(PrimitiveStore& Store, std::complex<double> Offset) const;
+    void AddMeshLines(PrimitiveStore& Store, std::complex<double> Offset) const;
+
+    // segment with both ends at the same point
+    bool IsRound() const { return m_Start == m_End; }
+    // round segment as cylinder, mesh lines at its x and y extent only
+    void AddCylinder(PrimitiveStore& Store, std::complex<double> Offset) const;
+    void AddCylinderMeshLines(PrimitiveStore& Store, std::complex<double> Offset) const;
 };
 
 class Via
 {
     double m_DrillSize;
     double m_MetalSize;
+    // emitted as cylinders instead of polygons
+    bool m_Native;
     Segment m_Cilinder;
     Segment m_Mill;
 
@@ -127,45 +167,58 @@ public:
         size_t Priority,
         size_t Approx,
         double WMill,
-        Configuration::MaterialProps& MaterialRing,
-        Configuration::MaterialProps& MaterialHole);
+        material_id_t MaterialRing,
+        material_id_t MaterialHole,
+        bool NativeCylinders,
+        VertexArena& Arena);
 
-    std::string GetCSX_Script();
-    MeshLines GetMeshData();
-    void GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& Material);
+    void AddTo(PrimitiveStore& Store, std::complex<double> Offset = 0) const;
 };
 
 class Zone
 {
-    std::vector<std::complex<double>> m_InnerOutline;
-    std::vector<std::complex<double>> m_RealOutline;
-    std::vector<pems::ExtrudedPolygon> m_OutlinePolys;
-    std::vector<pems::Segment> m_Segments;
+    // zone offset by half of outline width, empty if offset failed
+    VertexSpan m_Outline;
+    // fallback: inner polygon and border polygons around it
+    VertexSpan m_InnerOutline;
+    // mitered offset outline, gives mesh lines if m_Outline is empty
+    VertexSpan m_RealOutline;
+    // four points per border polygon
+    VertexSpan m_OutlinePolys;
     double m_Z;
     double m_T;
     size_t m_Priority;
     size_t m_Approx;
-    Configuration::MaterialProps m_Material;
-    double getVectAngle(std::complex<double> U, std::complex<double> V);
+    material_id_t m_Material;
+    // rectangular zone, emitted as box of m_RealOutline
+    bool m_IsBox;
+    // mesh line rules of zone material
+    bool m_OneThirdRule;
+    bool m_BoundaryLines;
+    double m_RuleDistance;
 
 public:
-    Zone(std::vector<std::complex<double>>& OutlineCenterPts,
+    Zone(const std::vector<std::complex<double>>& OutlineCenterPts,
          double Z,
          double W,
          double T,
          size_t Priority,
          size_t Approx,
-         Configuration::MaterialProps& Material,
-         bool OutlineIsCenter);
-
-    std::string GetCSX_Script();
-    MeshLines GetMeshData();
-    void GetXML_Primitive(tinyxml2::XMLElement* InsertNode, std::string& Material);
-    void ApproximatePolygon(std::vector<std::complex<double>>& Points, double MaxError);
+         const MaterialRegistry& Materials,
+         material_id_t Material,
+         bool OutlineIsCenter,
+         bool NativeBox,
+         VertexArena& Arena);
+
+    void AddTo(PrimitiveStore& Store) const;
+    void AddMeshLines(PrimitiveStore& Store) const;
+
+    // remove outline points while no removed point is more than MaxError away from the
+    // simplified outline, points whose removal would make it cross itself are kept,
+    // O(n log n)
+    static void ApproximatePolygon(std::vector<std::complex<double>>& Points, double MaxError);
 };
 
-// add approximation back
-
 } // namespace pems
 } // namespace kicad_to_ems
 
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ems_rtree.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+using namespace kicad_to_ems::pems;
+
+BoundingBox BoundingBox::Of(const std::complex<double>* Points, size_t Count)
+{
+    BoundingBox box = {0, 0, 0, 0};
+    if (Count == 0)
+        return box;
+    box.MinX = box.MaxX = Points[0].real();
+    box.MinY = box.MaxY = Points[0].imag();
+    for (size_t i = 1; i < Count; ++i)
+    {
+        box.MinX = std::min(box.MinX, Points[i].real());
+        box.MaxX = std::max(box.MaxX, Points[i].real());
+        box.MinY = std::min(box.MinY, Points[i].imag());
+        box.MaxY = std::max(box.MaxY, Points[i].imag());
+    }
+    return box;
+}
+
+void BoundingBox::Extend(const BoundingBox& Other)
+{
+    MinX = std::min(MinX, Other.MinX);
+    MinY = std::min(MinY, Other.MinY);
+    MaxX = std::max(MaxX, Other.MaxX);
+    MaxY = std::max(MaxY, Other.MaxY);
+}
+
+void BoxTree::Clear()
+{
+    m_Items.clear();
+    m_ItemBoxes.clear();
+    m_Nodes.clear();
+    m_LevelBegin.clear();
+}
+
+void BoxTree::Build(const std::vector<BoundingBox>& Boxes)
+{
+    Clear();
+    size_t count = Boxes.size();
+    if (count == 0)
+        return;
+
+    // sort tile: strips of about sqrt(leaf count) leaves, sorted by x, then by y
+    m_Items.resize(count);
+    std::iota(m_Items.begin(), m_Items.end(), 0);
+    auto center_x = [&Boxes](uint32_t I) { return Boxes[I].MinX + Boxes[I].MaxX; };
+    auto center_y = [&Boxes](uint32_t I) { return Boxes[I].MinY + Boxes[I].MaxY; };
+    std::sort(m_Items.begin(), m_Items.end(),
+              [&](uint32_t A, uint32_t B) { return center_x(A) < center_x(B); });
+
+    size_t leaves = (count + NODE_SIZE - 1) / NODE_SIZE;
+    size_t strip = (size_t)std::ceil(std::sqrt((double)leaves)) * NODE_SIZE;
+    for (size_t begin = 0; begin < count; begin += strip)
+    {
+        auto end = m_Items.begin() + std::min(begin + strip, count);
+        std::sort(m_Items.begin() + begin, end,
+                  [&](uint32_t A, uint32_t B) { return center_y(A) < center_y(B); });
+    }
+
+    m_ItemBoxes.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        m_ItemBoxes[i] = Boxes[m_Items[i]];
+
+    // pack each level into nodes of level above until one root is left
+    const std::vector<BoundingBox>* below = &m_ItemBoxes;
+    size_t below_begin = 0;
+    size_t below_count = count;
+    m_LevelBegin.push_back(0);
+    do
+    {
+        size_t level_begin = m_Nodes.size();
+        for (size_t first = 0; first < below_count; first += NODE_SIZE)
+        {
+            size_t last = std::min(first + NODE_SIZE, below_count);
+            BoundingBox box = (*below)[below_begin + first];
+            for (size_t i = first + 1; i < last; ++i)
+                box.Extend((*below)[below_begin + i]);
+            m_Nodes.push_back(box);
+        }
+        m_LevelBegin.push_back(m_Nodes.size());
+        below = &m_Nodes;
+        below_begin = level_begin;
+        below_count = m_Nodes.size() - level_begin;
+    } while (below_count > 1);
+}
+
+template <class Test>
+void BoxTree::Search(const BoundingBox& Region, Test Accept, std::vector<uint32_t>& Out) const
+{
+    if (m_Nodes.empty())
+        return;
+
+    // (level, index within level), root is the only node of last level
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.emplace_back(m_LevelBegin.size() - 2, 0);
+    while (!stack.empty())
+    {
+        size_t level = stack.back().first;
+        size_t node = stack.back().second;
+        stack.pop_back();
+        if (!Accept(m_Nodes[m_LevelBegin[level] + node], Region))
+            continue;
+
+        size_t first = node * NODE_SIZE;
+        if (level == 0)
+        {
+            size_t last = std::min(first + NODE_SIZE, m_Items.size());
+            for (size_t i = first; i < last; ++i)
+            {
+                if (m_Items[i] != NONE && Accept(m_ItemBoxes[i], Region))
+                    Out.push_back(m_Items[i]);
+            }
+            continue;
+        }
+        size_t last = std::min(first + NODE_SIZE,
+                               (size_t)(m_LevelBegin[level] - m_LevelBegin[level - 1]));
+        for (size_t i = first; i < last; ++i)
+            stack.emplace_back(level - 1, i);
+    }
+}
+
+void BoxTree::Query(const BoundingBox& Region, std::vector<uint32_t>& Out) const
+{
+    Search(Region,
+           [](const BoundingBox& Box, const BoundingBox& R) { return Box.Overlaps(R); }, Out);
+}
+
+void BoxTree::QueryContaining(const BoundingBox& Region, std::vector<uint32_t>& Out) const
+{
+    // node containing a box contains everything the box contains
+    Search(Region,
+           [](const BoundingBox& Box, const BoundingBox& R) { return Box.Contains(R); }, Out);
+}
+
+void BoxTree::Renumber(const std::vector<uint32_t>& NewIndex)
+{
+    for (size_t i = 0; i < m_Items.size(); ++i)
+    {
+        if (m_Items[i] != NONE)
+            m_Items[i] = NewIndex[m_Items[i]];
+    }
+}
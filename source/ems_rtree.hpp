@@ -0,0 +1,95 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ems_rtree_h
+#define ems_rtree_h
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kicad_to_ems
+{
+namespace pems
+{
+
+struct BoundingBox {
+    double MinX, MinY, MaxX, MaxY;
+
+    static BoundingBox Of(const std::complex<double>* Points, size_t Count);
+
+    // boxes sharing only an edge or corner overlap too
+    bool Overlaps(const BoundingBox& Other) const
+    {
+        return MinX <= Other.MaxX && Other.MinX <= MaxX && MinY <= Other.MaxY &&
+               Other.MinY <= MaxY;
+    }
+    bool Contains(const BoundingBox& Other) const
+    {
+        return MinX <= Other.MinX && Other.MaxX <= MaxX && MinY <= Other.MinY &&
+               Other.MaxY <= MaxY;
+    }
+    void Extend(const BoundingBox& Other);
+};
+
+/**
+    @brief Static R-tree of bounding boxes
+
+    Tree is bulk loaded once with sort-tile-recursive packing: boxes are sorted into
+    vertical strips by center x, each strip by center y, and runs of NODE_SIZE boxes
+    become leaves. Upper levels pack runs of NODE_SIZE nodes of level below, so a
+    region query visits O(log n) nodes plus the nodes of boxes it finds.
+*/
+class BoxTree
+{
+public:
+    void Build(const std::vector<BoundingBox>& Boxes);
+    void Clear();
+
+    size_t Size() const { return m_Items.size(); }
+    // indices of boxes overlapping or touching Region, in no particular order
+    void Query(const BoundingBox& Region, std::vector<uint32_t>& Out) const;
+    // indices of boxes containing Region, in no particular order
+    void QueryContaining(const BoundingBox& Region, std::vector<uint32_t>& Out) const;
+    // box I is reported as NewIndex[I] from now on, boxes mapped to NONE are left out;
+    // node boxes stay as they are, so removing boxes keeps the tree valid
+    void Renumber(const std::vector<uint32_t>& NewIndex);
+
+    static const uint32_t NONE = UINT32_MAX;
+
+private:
+    static const size_t NODE_SIZE = 16;
+
+    // input index and box of items in leaf order
+    std::vector<uint32_t> m_Items;
+    std::vector<BoundingBox> m_ItemBoxes;
+    // node boxes of all levels, leaf level first and root last; children of node i of
+    // a level are entries i * NODE_SIZE... of level below (items for leaf level)
+    std::vector<BoundingBox> m_Nodes;
+    std::vector<uint32_t> m_LevelBegin;
+
+    template <class Test>
+    void Search(const BoundingBox& Region, Test Accept, std::vector<uint32_t>& Out) const;
+};
+
+} // namespace pems
+} // namespace kicad_to_ems
+
+#endif // ems_rtree_h
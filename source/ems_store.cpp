@@ -0,0 +1,658 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ems_store.hpp"
+#include "ems_union.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+using namespace kicad_to_ems;
+using namespace kicad_to_ems::pems;
+
+class store_exc : public std::runtime_error
+{
+public:
+    store_exc(const char* Msg) : std::runtime_error(Msg) {}
+};
+
+PrimitiveStore::PrimitiveStore() : m_Indexed(false) { m_PolyBegin.push_back(0); }
+
+void PrimitiveStore::BeginObject()
+{
+    m_ObjectBegin.push_back(Size());
+    m_ObjectMeshX.push_back(m_MeshX.size());
+    m_ObjectMeshY.push_back(m_MeshY.size());
+    m_ObjectMeshZ.push_back(m_MeshZ.size());
+}
+
+size_t PrimitiveStore::ObjectEnd(size_t Object) const
+{
+    return Object + 1 < m_ObjectBegin.size() ? m_ObjectBegin[Object + 1] : Size();
+}
+
+const std::complex<double>* PrimitiveStore::Outline(size_t Poly,
+                                                    size_t& Count,
+                                                    std::complex<double>* Corners) const
+{
+    const std::complex<double>* points = m_Vertices.data() + m_PolyBegin[Poly];
+    Count = m_PolyBegin[Poly + 1] - m_PolyBegin[Poly];
+    if (m_Shape[Poly] == SHAPE_CYLINDER)
+        return nullptr;
+    if (m_Shape[Poly] == SHAPE_POLYGON)
+        return points;
+
+    // counter clockwise box corners
+    Corners[0] = points[0];
+    Corners[1] = std::complex<double>(points[1].real(), points[0].imag());
+    Corners[2] = points[1];
+    Corners[3] = std::complex<double>(points[0].real(), points[1].imag());
+    Count = 4;
+    return Corners;
+}
+
+void PrimitiveStore::CopyObject(const PrimitiveStore& From,
+                                size_t Object,
+                                const std::vector<bool>& Skip)
+{
+    BeginObject();
+    for (size_t i = From.m_ObjectBegin[Object]; i < From.ObjectEnd(Object); ++i)
+    {
+        if (Skip[i])
+            continue;
+        AddShape((Shape)From.m_Shape[i], From.m_Vertices.data() + From.m_PolyBegin[i],
+                 From.m_PolyBegin[i + 1] - From.m_PolyBegin[i], From.m_Radius[i], From.m_Z[i],
+                 From.m_T[i], From.m_Priority[i], From.m_Material[i], 0);
+    }
+
+    auto copy_lines = [Object](const std::vector<double>& Lines,
+                               const std::vector<uint32_t>& Begin, std::vector<double>& Out) {
+        size_t end = Object + 1 < Begin.size() ? Begin[Object + 1] : Lines.size();
+        Out.insert(Out.end(), Lines.begin() + Begin[Object], Lines.begin() + end);
+    };
+    copy_lines(From.m_MeshX, From.m_ObjectMeshX, m_MeshX);
+    copy_lines(From.m_MeshY, From.m_ObjectMeshY, m_MeshY);
+    copy_lines(From.m_MeshZ, From.m_ObjectMeshZ, m_MeshZ);
+}
+
+void PrimitiveStore::AddPolygon(const std::complex<double>* Outline,
+                                size_t Count,
+                                double Z,
+                                double T,
+                                size_t Priority,
+                                material_id_t Material,
+                                std::complex<double> Offset)
+{
+    if (Count == 0)
+        return;
+    AddShape(SHAPE_POLYGON, Outline, Count, 0, Z, T, Priority, Material, Offset);
+}
+
+void PrimitiveStore::AddCylinder(std::complex<double> Center,
+                                 double Radius,
+                                 double Z,
+                                 double T,
+                                 size_t Priority,
+                                 material_id_t Material,
+                                 std::complex<double> Offset)
+{
+    if (Radius <= 0)
+        return;
+    AddShape(SHAPE_CYLINDER, &Center, 1, Radius, Z, T, Priority, Material, Offset);
+}
+
+void PrimitiveStore::AddBox(std::complex<double> Min,
+                            std::complex<double> Max,
+                            double Z,
+                            double T,
+                            size_t Priority,
+                            material_id_t Material,
+                            std::complex<double> Offset)
+{
+    std::complex<double> corners[2] = {Min, Max};
+    AddShape(SHAPE_BOX, corners, 2, 0, Z, T, Priority, Material, Offset);
+}
+
+void PrimitiveStore::AddShape(Shape Kind,
+                              const std::complex<double>* Vertices,
+                              size_t Count,
+                              double Radius,
+                              double Z,
+                              double T,
+                              size_t Priority,
+                              material_id_t Material,
+                              std::complex<double> Offset)
+{
+    m_Index.clear();
+    m_Indexed = false;
+    for (size_t i = 0; i < Count; ++i)
+        m_Vertices.push_back(Vertices[i] + Offset);
+    m_PolyBegin.push_back(m_Vertices.size());
+    m_Z.push_back(Z);
+    m_T.push_back(T);
+    m_Priority.push_back(Priority);
+    m_Material.push_back(Material);
+    m_Shape.push_back(Kind);
+    m_Radius.push_back(Radius);
+}
+
+void PrimitiveStore::Append(const PrimitiveStore& Other)
+{
+    size_t poly_base = Size();
+    size_t vertex_base = m_Vertices.size();
+
+    // index is kept if both parts have one, trees of Other are renumbered
+    m_Indexed = (m_Indexed || Size() == 0) && (Other.m_Indexed || Other.Size() == 0);
+    if (!m_Indexed)
+        m_Index.clear();
+    else if (!Other.m_Index.empty())
+    {
+        std::vector<uint32_t> shift(Other.Size());
+        std::iota(shift.begin(), shift.end(), poly_base);
+        for (size_t i = 0; i < Other.m_Index.size(); ++i)
+        {
+            m_Index.push_back(Other.m_Index[i]);
+            m_Index.back().Renumber(shift);
+        }
+    }
+
+    for (size_t i = 0; i < Other.m_ObjectBegin.size(); ++i)
+    {
+        m_ObjectBegin.push_back(Other.m_ObjectBegin[i] + poly_base);
+        m_ObjectMeshX.push_back(Other.m_ObjectMeshX[i] + m_MeshX.size());
+        m_ObjectMeshY.push_back(Other.m_ObjectMeshY[i] + m_MeshY.size());
+        m_ObjectMeshZ.push_back(Other.m_ObjectMeshZ[i] + m_MeshZ.size());
+    }
+    for (size_t i = 1; i < Other.m_PolyBegin.size(); ++i)
+        m_PolyBegin.push_back(Other.m_PolyBegin[i] + vertex_base);
+
+    m_Vertices.insert(m_Vertices.end(), Other.m_Vertices.begin(), Other.m_Vertices.end());
+    m_Z.insert(m_Z.end(), Other.m_Z.begin(), Other.m_Z.end());
+    m_T.insert(m_T.end(), Other.m_T.begin(), Other.m_T.end());
+    m_Priority.insert(m_Priority.end(), Other.m_Priority.begin(), Other.m_Priority.end());
+    m_Material.insert(m_Material.end(), Other.m_Material.begin(), Other.m_Material.end());
+    m_Shape.insert(m_Shape.end(), Other.m_Shape.begin(), Other.m_Shape.end());
+    m_Radius.insert(m_Radius.end(), Other.m_Radius.begin(), Other.m_Radius.end());
+    m_MeshX.insert(m_MeshX.end(), Other.m_MeshX.begin(), Other.m_MeshX.end());
+    m_MeshY.insert(m_MeshY.end(), Other.m_MeshY.begin(), Other.m_MeshY.end());
+    m_MeshZ.insert(m_MeshZ.end(), Other.m_MeshZ.begin(), Other.m_MeshZ.end());
+}
+
+void PrimitiveStore::Clear() { *this = PrimitiveStore(); }
+
+void PrimitiveStore::MergeOverlapping()
+{
+    typedef std::tuple<double, double, uint32_t, material_id_t> key_t;
+    auto key = [this](size_t I) { return key_t(m_Z[I], m_T[I], m_Priority[I], m_Material[I]); };
+
+    // primitives of same key with overlapping bounds form groups, each is merged on its own
+    std::vector<size_t> parent(Size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](size_t i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+    std::vector<uint32_t> candidates;
+    for (size_t i = 0; i < Size(); ++i)
+    {
+        if (m_Shape[i] == SHAPE_CYLINDER)
+            continue;
+        candidates.clear();
+        Query(Bounds(i), candidates);
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            size_t j = candidates[c];
+            if (j > i && m_Shape[j] != SHAPE_CYLINDER && key(j) == key(i))
+                parent[find(i)] = find(j);
+        }
+    }
+
+    std::map<size_t, std::vector<size_t>> roots;
+    for (size_t i = 0; i < Size(); ++i)
+    {
+        if (m_Shape[i] != SHAPE_CYLINDER)
+            roots[find(i)].push_back(i);
+    }
+    // by key, then by first primitive
+    std::vector<std::vector<size_t>> groups;
+    for (auto& root : roots)
+    {
+        if (root.second.size() >= 2)
+            groups.push_back(std::move(root.second));
+    }
+    std::sort(groups.begin(), groups.end(),
+              [&key](const std::vector<size_t>& A, const std::vector<size_t>& B) {
+                  return std::make_pair(key(A[0]), A[0]) < std::make_pair(key(B[0]), B[0]);
+              });
+
+    std::vector<bool> merged(Size(), false);
+    PrimitiveStore out;
+    for (size_t g = 0; g < groups.size(); ++g)
+    {
+        const std::vector<size_t>& polys = groups[g];
+        PolygonUnion poly_union;
+        for (size_t i = 0; i < polys.size(); ++i)
+        {
+            size_t count;
+            std::complex<double> corners[4];
+            const std::complex<double>* outline = Outline(polys[i], count, corners);
+            poly_union.Add(outline, count);
+        }
+        poly_union.Run();
+
+        size_t first = polys[0];
+        for (size_t i = 0; i < polys.size(); ++i)
+            merged[polys[i]] = poly_union.IsMerged(i);
+        for (size_t i = 0; i < poly_union.MergedCount(); ++i)
+        {
+            size_t count;
+            const std::complex<double>* outline = poly_union.GetMerged(i, count);
+            out.BeginObject();
+            out.AddPolygon(outline, count, m_Z[first], m_T[first], m_Priority[first],
+                           m_Material[first]);
+        }
+    }
+
+    // objects keep polygons that were not merged and their mesh lines, merged polygons
+    // follow them
+    PrimitiveStore kept;
+    for (size_t obj = 0; obj < m_ObjectBegin.size(); ++obj)
+        kept.CopyObject(*this, obj, merged);
+    kept.Append(out);
+    *this = std::move(kept);
+}
+
+BoundingBox PrimitiveStore::Bounds(size_t Poly) const
+{
+    if (m_Shape[Poly] == SHAPE_CYLINDER)
+    {
+        std::complex<double> center = m_Vertices[m_PolyBegin[Poly]];
+        double r = m_Radius[Poly];
+        return BoundingBox{center.real() - r, center.imag() - r, center.real() + r,
+                           center.imag() + r};
+    }
+    return BoundingBox::Of(m_Vertices.data() + m_PolyBegin[Poly],
+                           m_PolyBegin[Poly + 1] - m_PolyBegin[Poly]);
+}
+
+size_t PrimitiveStore::RemoveCovered(const PrimitiveStore& Covers)
+{
+    typedef std::tuple<double, double, material_id_t> key_t;
+    std::vector<bool> covered(Size(), false);
+    std::vector<uint32_t> candidates;
+    for (size_t obj = 0; obj < Covers.m_ObjectBegin.size(); ++obj)
+    {
+        size_t body = Covers.ObjectEnd(obj);
+        if (body == Covers.m_ObjectBegin[obj] || Covers.m_Shape[body - 1] == SHAPE_CYLINDER)
+            continue;
+        body--;
+        size_t count;
+        std::complex<double> corners[4];
+        const std::complex<double>* outline = Covers.Outline(body, count, corners);
+        SlabPolygon zone(outline, count);
+        key_t key(Covers.m_Z[body], Covers.m_T[body], Covers.m_Material[body]);
+
+        // polygon can only be inside zones whose bounding box contains its own
+        BoundingBox zone_box = Covers.Bounds(body);
+        candidates.clear();
+        Query(zone_box, candidates);
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            size_t i = candidates[c];
+            if (covered[i] || key_t(m_Z[i], m_T[i], m_Material[i]) != key ||
+                !zone_box.Contains(Bounds(i)))
+                continue;
+            const std::complex<double>* poly = Outline(i, count, corners);
+            covered[i] = poly != nullptr && zone.Contains(poly, count);
+        }
+    }
+
+    // objects are dropped as a whole, with their mesh lines; index follows kept primitives
+    PrimitiveStore kept;
+    std::vector<bool> keep_all(Size(), false);
+    std::vector<uint32_t> new_index(Size(), BoxTree::NONE);
+    size_t removed = 0;
+    for (size_t obj = 0; obj < m_ObjectBegin.size(); ++obj)
+    {
+        bool all_covered = m_ObjectBegin[obj] < ObjectEnd(obj);
+        for (size_t i = m_ObjectBegin[obj]; i < ObjectEnd(obj); ++i)
+            all_covered &= covered[i];
+        if (all_covered)
+        {
+            removed++;
+            continue;
+        }
+        for (size_t i = m_ObjectBegin[obj]; i < ObjectEnd(obj); ++i)
+            new_index[i] = kept.Size() + (i - m_ObjectBegin[obj]);
+        kept.CopyObject(*this, obj, keep_all);
+    }
+    if (removed == 0)
+        return 0;
+
+    for (size_t i = 0; i < m_Index.size(); ++i)
+        m_Index[i].Renumber(new_index);
+    kept.m_Index = std::move(m_Index);
+    kept.m_Indexed = m_Indexed;
+    *this = std::move(kept);
+    return removed;
+}
+
+void PrimitiveStore::BuildIndex()
+{
+    std::vector<BoundingBox> bounds(Size());
+    for (size_t i = 0; i < Size(); ++i)
+        bounds[i] = Bounds(i);
+    m_Index.assign(1, BoxTree());
+    m_Index[0].Build(bounds);
+    m_Indexed = true;
+}
+
+void PrimitiveStore::Query(const BoundingBox& Region, std::vector<uint32_t>& Out)
+{
+    if (!m_Indexed)
+        BuildIndex();
+    for (size_t i = 0; i < m_Index.size(); ++i)
+        m_Index[i].Query(Region, Out);
+}
+
+void PrimitiveStore::AppendCSX_Script(std::string& Script, const MaterialRegistry& Materials) const
+{
+    for (size_t i = 0; i < Size(); ++i)
+    {
+        if (m_Shape[i] == SHAPE_CYLINDER)
+            AppendCylinderScript(i, Script, Materials);
+        else if (m_Shape[i] == SHAPE_BOX)
+            AppendBoxScript(i, Script, Materials);
+        else
+            AppendPolygonScript(i, Script, Materials);
+    }
+}
+
+void PrimitiveStore::AppendPolygonScript(size_t Poly,
+                                         std::string& Script,
+                                         const MaterialRegistry& Materials) const
+{
+    const std::complex<double>* points = m_Vertices.data() + m_PolyBegin[Poly];
+    size_t count = m_PolyBegin[Poly + 1] - m_PolyBegin[Poly];
+
+    // repeated points are skipped
+    size_t unique = 1;
+    for (size_t i = 1, last = 0; i < count; ++i)
+    {
+        if (points[i] == points[last])
+            continue;
+        last = i;
+        unique++;
+    }
+
+    // fits any two doubles printed with %.6f
+    char buffer[768];
+    snprintf(buffer, sizeof(buffer), "p=zeros(2,%ld);\n", (long)unique);
+    Script += buffer;
+
+    long p = 1;
+    for (size_t i = 0, last = 0; i < count; ++i)
+    {
+        if (i > 0 && points[i] == points[last])
+            continue;
+        last = i;
+        snprintf(buffer, sizeof(buffer), "p(1,%ld)=%.6f;p(2,%ld)=%.6f;\n", p, points[i].real(), p,
+                 points[i].imag());
+        Script += buffer;
+        p++;
+    }
+
+    const std::string& material = Materials.GetName(m_Material[Poly]);
+    if (m_T[Poly] == 0)
+    {
+        Script += "CSX = AddPolygon(CSX, '" + material + "', ";
+        snprintf(buffer, sizeof(buffer), "%ld, 2, %.6f, p);\n", (long)m_Priority[Poly], m_Z[Poly]);
+    }
+    else
+    {
+        Script += "CSX = AddLinPoly(CSX, '" + material + "', ";
+        snprintf(buffer, sizeof(buffer), "%ld, 2, %.6f, p, %.6f);\n", (long)m_Priority[Poly],
+                 m_Z[Poly], m_T[Poly]);
+    }
+    Script += buffer;
+}
+
+void PrimitiveStore::AppendCylinderScript(size_t Poly,
+                                          std::string& Script,
+                                          const MaterialRegistry& Materials) const
+{
+    std::complex<double> center = m_Vertices[m_PolyBegin[Poly]];
+    char buffer[768];
+    Script += "CSX = AddCylinder(CSX, '" + Materials.GetName(m_Material[Poly]) + "', ";
+    snprintf(buffer, sizeof(buffer), "%ld, [%.6f %.6f %.6f], [%.6f %.6f %.6f], %.6f);\n",
+             (long)m_Priority[Poly], center.real(), center.imag(), m_Z[Poly], center.real(),
+             center.imag(), m_Z[Poly] + m_T[Poly], m_Radius[Poly]);
+    Script += buffer;
+}
+
+void PrimitiveStore::AppendBoxScript(size_t Poly,
+                                     std::string& Script,
+                                     const MaterialRegistry& Materials) const
+{
+    const std::complex<double>* corners = m_Vertices.data() + m_PolyBegin[Poly];
+    char buffer[768];
+    Script += "CSX = AddBox(CSX, '" + Materials.GetName(m_Material[Poly]) + "', ";
+    snprintf(buffer, sizeof(buffer), "%ld, [%.6f %.6f %.6f], [%.6f %.6f %.6f]);\n",
+             (long)m_Priority[Poly], corners[0].real(), corners[0].imag(), m_Z[Poly],
+             corners[1].real(), corners[1].imag(), m_Z[Poly] + m_T[Poly]);
+    Script += buffer;
+}
+
+void PrimitiveStore::GetXML_Primitives(material_id_t Material,
+                                       tinyxml2::XMLElement* InsertNode) const
+{
+    for (size_t obj = 0; obj < m_ObjectBegin.size(); ++obj)
+    {
+        size_t begin = m_ObjectBegin[obj];
+        size_t end = ObjectEnd(obj);
+        if (begin == end)
+            continue;
+
+        if (m_Material[end - 1] == Material)
+            GetXML_Primitive(end - 1, InsertNode);
+        for (size_t i = begin; i < end - 1; ++i)
+        {
+            if (m_Material[i] == Material)
+                GetXML_Primitive(i, InsertNode);
+        }
+    }
+}
+
+void PrimitiveStore::GetXML_Primitive(size_t Poly, tinyxml2::XMLElement* InsertNode) const
+{
+    if (m_Shape[Poly] == SHAPE_CYLINDER)
+        GetXML_Cylinder(Poly, InsertNode);
+    else if (m_Shape[Poly] == SHAPE_BOX)
+        GetXML_Box(Poly, InsertNode);
+    else
+        GetXML_Polygon(Poly, InsertNode);
+}
+
+void PrimitiveStore::GetXML_Polygon(size_t Poly, tinyxml2::XMLElement* InsertNode) const
+{
+    const std::complex<double>* points = m_Vertices.data() + m_PolyBegin[Poly];
+    size_t count = m_PolyBegin[Poly + 1] - m_PolyBegin[Poly];
+
+    tinyxml2::XMLElement* lin_poly;
+    if (m_T[Poly] != 0)
+        lin_poly = InsertNode->GetDocument()->NewElement("LinPoly");
+    else
+        lin_poly = InsertNode->GetDocument()->NewElement("Polygon");
+    if (lin_poly == nullptr)
+        throw store_exc("TinyXML2 Create NewElement() failed");
+    lin_poly->SetAttribute("Priority", (unsigned int)m_Priority[Poly]);
+    lin_poly->SetAttribute("Elevation", m_Z[Poly]);
+    if (m_T[Poly] != 0)
+        lin_poly->SetAttribute("Length", m_T[Poly]);
+    lin_poly->SetAttribute("NormDir", 2);
+
+    for (size_t i = 0, last = 0; i < count; ++i)
+    {
+        if (i > 0 && points[i] == points[last])
+            continue;
+        last = i;
+
+        tinyxml2::XMLElement* vertex = lin_poly->GetDocument()->NewElement("Vertex");
+        if (vertex == nullptr)
+            throw store_exc("TinyXML2 Create NewElement() failed");
+
+        vertex->SetAttribute("X1", points[i].real());
+        vertex->SetAttribute("X2", points[i].imag());
+        lin_poly->InsertEndChild(vertex);
+    }
+
+    InsertNode->InsertEndChild(lin_poly);
+}
+
+void PrimitiveStore::GetXML_Cylinder(size_t Poly, tinyxml2::XMLElement* InsertNode) const
+{
+    tinyxml2::XMLDocument* doc = InsertNode->GetDocument();
+    tinyxml2::XMLElement* cylinder = doc->NewElement("Cylinder");
+    tinyxml2::XMLElement* start = doc->NewElement("P1");
+    tinyxml2::XMLElement* stop = doc->NewElement("P2");
+    if (cylinder == nullptr || start == nullptr || stop == nullptr)
+        throw store_exc("TinyXML2 Create NewElement() failed");
+
+    std::complex<double> center = m_Vertices[m_PolyBegin[Poly]];
+    cylinder->SetAttribute("Priority", (unsigned int)m_Priority[Poly]);
+    cylinder->SetAttribute("Radius", m_Radius[Poly]);
+    start->SetAttribute("X", center.real());
+    start->SetAttribute("Y", center.imag());
+    start->SetAttribute("Z", m_Z[Poly]);
+    stop->SetAttribute("X", center.real());
+    stop->SetAttribute("Y", center.imag());
+    stop->SetAttribute("Z", m_Z[Poly] + m_T[Poly]);
+    cylinder->InsertEndChild(start);
+    cylinder->InsertEndChild(stop);
+
+    InsertNode->InsertEndChild(cylinder);
+}
+
+void PrimitiveStore::GetXML_Box(size_t Poly, tinyxml2::XMLElement* InsertNode) const
+{
+    tinyxml2::XMLDocument* doc = InsertNode->GetDocument();
+    tinyxml2::XMLElement* box = doc->NewElement("Box");
+    tinyxml2::XMLElement* start = doc->NewElement("P1");
+    tinyxml2::XMLElement* stop = doc->NewElement("P2");
+    if (box == nullptr || start == nullptr || stop == nullptr)
+        throw store_exc("TinyXML2 Create NewElement() failed");
+
+    const std::complex<double>* corners = m_Vertices.data() + m_PolyBegin[Poly];
+    box->SetAttribute("Priority", (unsigned int)m_Priority[Poly]);
+    start->SetAttribute("X", corners[0].real());
+    start->SetAttribute("Y", corners[0].imag());
+    start->SetAttribute("Z", m_Z[Poly]);
+    stop->SetAttribute("X", corners[1].real());
+    stop->SetAttribute("Y", corners[1].imag());
+    stop->SetAttribute("Z", m_Z[Poly] + m_T[Poly]);
+    box->InsertEndChild(start);
+    box->InsertEndChild(stop);
+
+    InsertNode->InsertEndChild(box);
+}
+
+void PrimitiveStore::AddMeshLines(MeshLines& Mesh) const
+{
+    Mesh.X.insert(m_MeshX.begin(), m_MeshX.end());
+    Mesh.Y.insert(m_MeshY.begin(), m_MeshY.end());
+    Mesh.Z.insert(m_MeshZ.begin(), m_MeshZ.end());
+}
+
+void PrimitiveStore::Save(CacheWriter& Out) const
+{
+    Out.PutArray(m_Vertices);
+    Out.PutArray(m_PolyBegin);
+    Out.PutArray(m_ObjectBegin);
+    Out.PutArray(m_ObjectMeshX);
+    Out.PutArray(m_ObjectMeshY);
+    Out.PutArray(m_ObjectMeshZ);
+    Out.PutArray(m_Z);
+    Out.PutArray(m_T);
+    Out.PutArray(m_Priority);
+    Out.PutArray(m_Material);
+    Out.PutArray(m_Shape);
+    Out.PutArray(m_Radius);
+    Out.PutArray(m_MeshX);
+    Out.PutArray(m_MeshY);
+    Out.PutArray(m_MeshZ);
+}
+
+void PrimitiveStore::Load(CacheReader& In)
+{
+    m_Index.clear();
+    m_Indexed = false;
+    In.GetArray(m_Vertices);
+    In.GetArray(m_PolyBegin);
+    In.GetArray(m_ObjectBegin);
+    In.GetArray(m_ObjectMeshX);
+    In.GetArray(m_ObjectMeshY);
+    In.GetArray(m_ObjectMeshZ);
+    In.GetArray(m_Z);
+    In.GetArray(m_T);
+    In.GetArray(m_Priority);
+    In.GetArray(m_Material);
+    In.GetArray(m_Shape);
+    In.GetArray(m_Radius);
+    In.GetArray(m_MeshX);
+    In.GetArray(m_MeshY);
+    In.GetArray(m_MeshZ);
+
+    // indices are used without further checks
+    size_t polys = m_Z.size();
+    bool valid = m_PolyBegin.size() == polys + 1 && m_T.size() == polys &&
+                 m_Priority.size() == polys && m_Material.size() == polys &&
+                 m_Shape.size() == polys && m_Radius.size() == polys &&
+                 m_PolyBegin[0] == 0 && m_PolyBegin[polys] == m_Vertices.size();
+    for (size_t i = 0; valid && i < polys; ++i)
+    {
+        valid = m_PolyBegin[i] <= m_PolyBegin[i + 1] && m_Material[i] < MaterialRegistry::COUNT;
+        size_t count = m_PolyBegin[i + 1] - m_PolyBegin[i];
+        if (valid && m_Shape[i] == SHAPE_CYLINDER)
+            valid = count == 1;
+        else if (valid && m_Shape[i] == SHAPE_BOX)
+            valid = count == 2;
+        else if (valid)
+            valid = m_Shape[i] == SHAPE_POLYGON;
+    }
+    size_t objects = m_ObjectBegin.size();
+    valid = valid && m_ObjectMeshX.size() == objects && m_ObjectMeshY.size() == objects &&
+            m_ObjectMeshZ.size() == objects;
+    for (size_t i = 0; valid && i < objects; ++i)
+    {
+        valid = m_ObjectBegin[i] <= polys && m_ObjectMeshX[i] <= m_MeshX.size() &&
+                m_ObjectMeshY[i] <= m_MeshY.size() && m_ObjectMeshZ[i] <= m_MeshZ.size();
+        if (valid && i > 0)
+            valid = m_ObjectBegin[i - 1] <= m_ObjectBegin[i] &&
+                    m_ObjectMeshX[i - 1] <= m_ObjectMeshX[i] &&
+                    m_ObjectMeshY[i - 1] <= m_ObjectMeshY[i] &&
+                    m_ObjectMeshZ[i - 1] <= m_ObjectMeshZ[i];
+    }
+    if (!valid)
+        throw store_exc("Cache: corrupt primitive store");
+}
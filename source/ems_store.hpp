@@ -0,0 +1,183 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ems_store_h
+#define ems_store_h
+
+#include "ems_cache.hpp"
+#include "ems_materials.hpp"
+#include "ems_rtree.hpp"
+
+#include <tinyxml2.h>
+#include <complex>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace kicad_to_ems
+{
+namespace pems
+{
+
+struct MeshLines {
+    std::set<double> X;
+    std::set<double> Y;
+    std::set<double> Z;
+};
+
+/**
+    @brief Flat storage of extruded polygons and mesh lines of the model
+
+    Outline vertices of all polygons are kept in one array, other polygon values in
+    parallel arrays indexed by polygon number. Cylinders are stored the same way, with
+    their center as the only vertex, boxes with their two corners. Polygons are grouped
+    by the object (segment, via, zone) they were generated from. Mesh line positions of
+    all objects are appended to flat arrays in object order, duplicates are removed when
+    the mesh is generated.
+*/
+class PrimitiveStore
+{
+public:
+    enum Shape : uint8_t
+    {
+        SHAPE_POLYGON,
+        SHAPE_CYLINDER,
+        SHAPE_BOX
+    };
+
+    PrimitiveStore();
+
+    // start new object, following polygons belong to it
+    void BeginObject();
+    // empty outlines are ignored
+    void AddPolygon(const std::complex<double>* Outline,
+                    size_t Count,
+                    double Z,
+                    double T,
+                    size_t Priority,
+                    material_id_t Material,
+                    std::complex<double> Offset = 0);
+    // cylinder from Z to Z + T, written as native CSX primitive, ignored if Radius is 0
+    void AddCylinder(std::complex<double> Center,
+                     double Radius,
+                     double Z,
+                     double T,
+                     size_t Priority,
+                     material_id_t Material,
+                     std::complex<double> Offset = 0);
+    // axis aligned box from Z to Z + T, written as native CSX primitive
+    void AddBox(std::complex<double> Min,
+                std::complex<double> Max,
+                double Z,
+                double T,
+                size_t Priority,
+                material_id_t Material,
+                std::complex<double> Offset = 0);
+    void AddMeshLineX(double X) { m_MeshX.push_back(X); }
+    void AddMeshLineY(double Y) { m_MeshY.push_back(Y); }
+    void AddMeshLineZ(double Z) { m_MeshZ.push_back(Z); }
+
+    void Append(const PrimitiveStore& Other);
+    void Clear();
+    // replace overlapping polygons and boxes of same elevation, thickness, priority and
+    // material with their union, each merged polygon is an object of its own. Cylinders
+    // are left as is. Mesh lines are kept.
+    void MergeOverlapping();
+    // remove objects whose polygons all lie inside last polygon (zone body) of an object
+    // of Covers with same elevation, thickness and material, mesh lines of removed
+    // objects are removed too. Returns number of removed objects.
+    size_t RemoveCovered(const PrimitiveStore& Covers);
+    size_t Size() const { return m_Z.size(); }
+    BoundingBox Bounds(size_t Poly) const;
+    // index of primitive bounds, kept by Append and RemoveCovered, other changes drop it
+    void BuildIndex();
+    // primitives whose bounds overlap or touch Region, index is built if there is none
+    void Query(const BoundingBox& Region, std::vector<uint32_t>& Out);
+
+    // polygons in insertion order
+    void AppendCSX_Script(std::string& Script, const MaterialRegistry& Materials) const;
+    // polygons of given material, object's last polygon first (zone inner outline, via drill)
+    void GetXML_Primitives(material_id_t Material, tinyxml2::XMLElement* InsertNode) const;
+    void AddMeshLines(MeshLines& Mesh) const;
+
+    void Save(CacheWriter& Out) const;
+    void Load(CacheReader& In);
+
+private:
+    std::vector<std::complex<double>> m_Vertices;
+    // first vertex of polygon, one extra entry for the end of last polygon
+    std::vector<uint32_t> m_PolyBegin;
+    // first polygon and first mesh lines of object
+    std::vector<uint32_t> m_ObjectBegin;
+    std::vector<uint32_t> m_ObjectMeshX;
+    std::vector<uint32_t> m_ObjectMeshY;
+    std::vector<uint32_t> m_ObjectMeshZ;
+    std::vector<double> m_Z;
+    std::vector<double> m_T;
+    std::vector<uint32_t> m_Priority;
+    std::vector<material_id_t> m_Material;
+    std::vector<uint8_t> m_Shape;
+    // cylinder radius, 0 for polygons
+    std::vector<double> m_Radius;
+
+    std::vector<double> m_MeshX;
+    std::vector<double> m_MeshY;
+    std::vector<double> m_MeshZ;
+
+    // trees of bounds, appended stores bring their own tree
+    std::vector<BoxTree> m_Index;
+    bool m_Indexed;
+
+    size_t ObjectEnd(size_t Object) const;
+    // outline vertices of polygon or box (written to Corners), nullptr for cylinders
+    const std::complex<double>* Outline(size_t Poly,
+                                        size_t& Count,
+                                        std::complex<double>* Corners) const;
+    // append object of From with its mesh lines, polygons marked in Skip are left out
+    void CopyObject(const PrimitiveStore& From, size_t Object, const std::vector<bool>& Skip);
+    void AddShape(Shape Kind,
+                  const std::complex<double>* Vertices,
+                  size_t Count,
+                  double Radius,
+                  double Z,
+                  double T,
+                  size_t Priority,
+                  material_id_t Material,
+                  std::complex<double> Offset);
+
+    void AppendPolygonScript(size_t Poly,
+                             std::string& Script,
+                             const MaterialRegistry& Materials) const;
+    void AppendCylinderScript(size_t Poly,
+                              std::string& Script,
+                              const MaterialRegistry& Materials) const;
+    void AppendBoxScript(size_t Poly,
+                         std::string& Script,
+                         const MaterialRegistry& Materials) const;
+    void GetXML_Primitive(size_t Poly, tinyxml2::XMLElement* InsertNode) const;
+    void GetXML_Polygon(size_t Poly, tinyxml2::XMLElement* InsertNode) const;
+    void GetXML_Cylinder(size_t Poly, tinyxml2::XMLElement* InsertNode) const;
+    void GetXML_Box(size_t Poly, tinyxml2::XMLElement* InsertNode) const;
+};
+
+} // namespace pems
+} // namespace kicad_to_ems
+
+#endif // ems_store_h
@@ -0,0 +1,1392 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ems_union.hpp"
+#include "misc.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+
+using namespace kicad_to_ems::pems;
+using std::complex;
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static inline bool pt_less(complex<double> A, complex<double> B)
+{
+    return A.real() < B.real() || (A.real() == B.real() && A.imag() < B.imag());
+}
+
+static double signed_area(const complex<double>* Points, size_t Count)
+{
+    double area = 0;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        complex<double> a = Points[i];
+        complex<double> b = Points[i + 1 < Count ? i + 1 : 0];
+        area += a.real() * b.imag() - b.real() * a.imag();
+    }
+    return area / 2;
+}
+
+// B lies on straight line between A and C
+static bool is_collinear(complex<double> A, complex<double> B, complex<double> C)
+{
+    complex<double> u = B - A;
+    complex<double> v = C - B;
+    double cross = u.real() * v.imag() - u.imag() * v.real();
+    double dot = u.real() * v.real() + u.imag() * v.imag();
+    return dot > 0 && std::fabs(cross) <= 1e-12 * std::abs(u) * std::abs(v);
+}
+
+static void remove_collinear(std::vector<complex<double>>& Points)
+{
+    std::vector<complex<double>> out;
+    for (size_t i = 0; i < Points.size(); ++i)
+    {
+        while (out.size() >= 2 && is_collinear(out[out.size() - 2], out.back(), Points[i]))
+            out.pop_back();
+        out.push_back(Points[i]);
+    }
+    // closing corner
+    while (out.size() >= 3 && is_collinear(out[out.size() - 2], out.back(), out[0]))
+        out.pop_back();
+    size_t first = 0;
+    while (out.size() - first >= 3 && is_collinear(out.back(), out[first], out[first + 1]))
+        first++;
+    Points.assign(out.begin() + first, out.end());
+}
+
+// removes concave and straight corners of counter clockwise outline that are at most
+// Tolerance away from line through their neighbors, so that rounding of a smooth outline
+// doesn't leave tiny notches; outline only grows
+static void remove_notches(std::vector<complex<double>>& Points, double Tolerance)
+{
+    auto notch = [Tolerance](complex<double> A, complex<double> B, complex<double> C) {
+        double len = std::abs(C - A);
+        double cross = Misc::orient(A, B, C);
+        return len > 0 && cross <= 0 && -cross <= Tolerance * len;
+    };
+
+    std::vector<complex<double>> out;
+    for (size_t i = 0; i < Points.size(); ++i)
+    {
+        while (out.size() >= 2 && notch(out[out.size() - 2], out.back(), Points[i]))
+            out.pop_back();
+        out.push_back(Points[i]);
+    }
+    // closing corners
+    size_t first = 0;
+    bool removed = true;
+    while (removed && out.size() - first > 3)
+    {
+        removed = false;
+        if (notch(out[out.size() - 2], out.back(), out[first]))
+        {
+            out.pop_back();
+            removed = true;
+        }
+        else if (notch(out.back(), out[first], out[first + 1]))
+        {
+            first++;
+            removed = true;
+        }
+    }
+    Points.assign(out.begin() + first, out.end());
+}
+
+// position of Point projected on edge A0 A1, 0 - at A0, 1 - at A1
+static double edge_param(complex<double> A0, complex<double> A1, complex<double> Point)
+{
+    complex<double> d = A1 - A0;
+    complex<double> p = Point - A0;
+    return (p.real() * d.real() + p.imag() * d.imag()) / std::norm(d);
+}
+
+// closed outlines formed by edges with area on their left, edges are sorted by start point.
+// False if an edge leads nowhere or two outlines run through the same edge.
+template <class Edge>
+static bool trace_cycles(const std::vector<Edge>& Edges,
+                         std::vector<std::vector<complex<double>>>& Cycles)
+{
+    auto outgoing = [&Edges](complex<double> Point) {
+        return std::equal_range(Edges.begin(), Edges.end(), Edge{Point, Point},
+                                [](const Edge& A, const Edge& B) {
+                                    return pt_less(A.Start, B.Start);
+                                });
+    };
+
+    std::vector<bool> used(Edges.size(), false);
+    for (size_t first = 0; first < Edges.size(); ++first)
+    {
+        if (used[first])
+            continue;
+
+        std::vector<complex<double>> cycle;
+        size_t edge = first;
+        while (true)
+        {
+            used[edge] = true;
+            cycle.push_back(Edges[edge].Start);
+
+            // area is on the left, next edge is the first one clockwise from way back
+            complex<double> back = Edges[edge].Start - Edges[edge].End;
+            auto range = outgoing(Edges[edge].End);
+            if (range.first == range.second)
+                return false;
+            size_t next = range.first - Edges.begin();
+            double best = 10;
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                complex<double> d = it->End - it->Start;
+                // clockwise angle from back to d in (0, 2 pi]
+                double angle = std::arg(back) - std::arg(d);
+                while (angle <= 0)
+                    angle += 2 * M_PI;
+                while (angle > 2 * M_PI)
+                    angle -= 2 * M_PI;
+                if (angle < best)
+                {
+                    best = angle;
+                    next = it - Edges.begin();
+                }
+            }
+
+            if (next == first)
+                break;
+            if (used[next])
+                return false;
+            edge = next;
+        }
+
+        remove_collinear(cycle);
+        if (cycle.size() >= 3)
+            Cycles.push_back(std::move(cycle));
+    }
+    return true;
+}
+
+// one polygon of counter clockwise outer outline and clockwise holes, each hole is
+// connected to the outline or to another hole with a zero width bridge
+static bool bridge_holes(const std::vector<std::vector<complex<double>>>& Cycles,
+                         std::vector<complex<double>>& Out)
+{
+    // one outer outline, holes and slivers left by rounding
+    size_t outer = Cycles.size();
+    double outer_area = 0;
+    for (size_t c = 0; c < Cycles.size(); ++c)
+    {
+        double area = signed_area(Cycles[c].data(), Cycles[c].size());
+        if (area > outer_area)
+        {
+            outer = c;
+            outer_area = area;
+        }
+    }
+    if (outer == Cycles.size())
+        return false;
+
+    std::vector<size_t> rings(1, outer);
+    for (size_t c = 0; c < Cycles.size(); ++c)
+    {
+        double area = signed_area(Cycles[c].data(), Cycles[c].size());
+        if (c == outer || std::fabs(area) <= 1e-12 * outer_area)
+            continue;
+        // second outer outline
+        if (area > 0)
+            return false;
+        rings.push_back(c);
+    }
+    if (rings.size() == 1)
+    {
+        Out = Cycles[outer];
+        return true;
+    }
+
+    // all edges of all rings
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    std::vector<double> min_y, max_y;
+    for (size_t r = 0; r < rings.size(); ++r)
+    {
+        const std::vector<complex<double>>& ring = Cycles[rings[r]];
+        for (size_t i = 0; i < ring.size(); ++i)
+        {
+            double y0 = ring[i].imag();
+            double y1 = ring[i + 1 < ring.size() ? i + 1 : 0].imag();
+            edges.push_back(std::make_pair((uint32_t)r, (uint32_t)i));
+            min_y.push_back(std::min(y0, y1));
+            max_y.push_back(std::max(y0, y1));
+        }
+    }
+    SlabIndex slabs;
+    slabs.Build(min_y, max_y);
+
+    // each hole is bridged from its leftmost point to the nearest edge on the left
+    struct Link {
+        double T;
+        complex<double> Point;
+        size_t Hole;
+    };
+    // bridges leaving each edge, by ring and edge
+    std::vector<std::vector<std::vector<Link>>> bridges(rings.size());
+    std::vector<size_t> leftmost(rings.size(), 0);
+    for (size_t r = 0; r < rings.size(); ++r)
+        bridges[r].resize(Cycles[rings[r]].size());
+
+    for (size_t h = 1; h < rings.size(); ++h)
+    {
+        const std::vector<complex<double>>& hole = Cycles[rings[h]];
+        for (size_t i = 1; i < hole.size(); ++i)
+        {
+            if (pt_less(hole[i], hole[leftmost[h]]))
+                leftmost[h] = i;
+        }
+        complex<double> start = hole[leftmost[h]];
+
+        bool found = false;
+        double best_x = 0;
+        size_t best_ring = 0, best_edge = 0;
+        size_t s = slabs.Slab(start.imag());
+        for (const uint32_t* it = slabs.EdgesBegin(s); it != slabs.EdgesEnd(s); ++it)
+        {
+            size_t r = edges[*it].first;
+            size_t i = edges[*it].second;
+            if (r == h)
+                continue;
+            const std::vector<complex<double>>& ring = Cycles[rings[r]];
+            complex<double> a = ring[i];
+            complex<double> b = ring[i + 1 < ring.size() ? i + 1 : 0];
+            if ((a.imag() > start.imag()) == (b.imag() > start.imag()))
+                continue;
+            double x = a.real() + (start.imag() - a.imag()) * (b.real() - a.real()) /
+                                      (b.imag() - a.imag());
+            if (x <= start.real() && (!found || x > best_x))
+            {
+                found = true;
+                best_x = x;
+                best_ring = r;
+                best_edge = i;
+            }
+        }
+        if (!found)
+            return false;
+
+        const std::vector<complex<double>>& ring = Cycles[rings[best_ring]];
+        complex<double> a = ring[best_edge];
+        complex<double> b = ring[best_edge + 1 < ring.size() ? best_edge + 1 : 0];
+        complex<double> point(best_x, start.imag());
+        bridges[best_ring][best_edge].push_back(Link{edge_param(a, b, point), point, h});
+    }
+
+    // walk outer outline, entering each hole at its bridge and coming back the same way
+    struct Frame {
+        size_t Ring;
+        // edge of ring counted from its leftmost point and next bridge leaving it
+        size_t Edge;
+        size_t Next;
+    };
+    for (size_t r = 0; r < rings.size(); ++r)
+    {
+        for (size_t i = 0; i < bridges[r].size(); ++i)
+            std::sort(bridges[r][i].begin(), bridges[r][i].end(),
+                      [](const Link& A, const Link& B) { return A.T < B.T; });
+    }
+
+    std::vector<bool> entered(rings.size(), false);
+    std::vector<Frame> stack(1, Frame{0, 0, 0});
+    entered[0] = true;
+    Out.assign(1, Cycles[rings[0]][leftmost[0]]);
+    while (!stack.empty())
+    {
+        Frame& top = stack.back();
+        const std::vector<complex<double>>& ring = Cycles[rings[top.Ring]];
+        size_t count = ring.size();
+        const std::vector<Link>& edge_bridges =
+            bridges[top.Ring][(leftmost[top.Ring] + top.Edge) % count];
+        if (top.Next < edge_bridges.size())
+        {
+            const Link& bridge = edge_bridges[top.Next++];
+            if (entered[bridge.Hole])
+                return false;
+            entered[bridge.Hole] = true;
+            Out.push_back(bridge.Point);
+            Out.push_back(Cycles[rings[bridge.Hole]][leftmost[bridge.Hole]]);
+            stack.push_back(Frame{bridge.Hole, 0, 0});
+            continue;
+        }
+        if (++top.Edge < count)
+        {
+            top.Next = 0;
+            Out.push_back(ring[(leftmost[top.Ring] + top.Edge) % count]);
+            continue;
+        }
+
+        size_t done = top.Ring;
+        stack.pop_back();
+        if (!stack.empty())
+        {
+            const Frame& parent = stack.back();
+            size_t parent_count = Cycles[rings[parent.Ring]].size();
+            const Link& bridge =
+                bridges[parent.Ring][(leftmost[parent.Ring] + parent.Edge) % parent_count]
+                       [parent.Next - 1];
+            Out.push_back(Cycles[rings[done]][leftmost[done]]);
+            Out.push_back(bridge.Point);
+        }
+    }
+    return std::find(entered.begin(), entered.end(), false) == entered.end();
+}
+
+void PolygonUnion::Add(const complex<double>* Outline, size_t Count)
+{
+    Poly poly;
+    poly.Begin = m_Points.size();
+    poly.Count = 0;
+    poly.MinX = poly.MinY = poly.MaxX = poly.MaxY = 0;
+
+    for (size_t i = 0; i < Count; ++i)
+    {
+        if (m_Points.size() > poly.Begin && Outline[i] == m_Points.back())
+            continue;
+        m_Points.push_back(Outline[i]);
+    }
+    while (m_Points.size() - poly.Begin > 1 && m_Points.back() == m_Points[poly.Begin])
+        m_Points.pop_back();
+
+    size_t count = m_Points.size() - poly.Begin;
+    double area = count >= 3 ? signed_area(&m_Points[poly.Begin], count) : 0;
+    if (area == 0 || !std::isfinite(area))
+    {
+        m_Points.resize(poly.Begin);
+        m_Polys.push_back(poly);
+        return;
+    }
+    if (area < 0)
+        std::reverse(m_Points.begin() + poly.Begin, m_Points.end());
+    m_Owner.resize(m_Points.size(), m_Polys.size());
+
+    poly.Count = count;
+    poly.MinX = poly.MaxX = m_Points[poly.Begin].real();
+    poly.MinY = poly.MaxY = m_Points[poly.Begin].imag();
+    for (size_t i = poly.Begin; i < m_Points.size(); ++i)
+    {
+        poly.MinX = std::min(poly.MinX, m_Points[i].real());
+        poly.MaxX = std::max(poly.MaxX, m_Points[i].real());
+        poly.MinY = std::min(poly.MinY, m_Points[i].imag());
+        poly.MaxY = std::max(poly.MaxY, m_Points[i].imag());
+    }
+    m_Polys.push_back(poly);
+}
+
+const complex<double>* PolygonUnion::GetMerged(size_t Index, size_t& Count) const
+{
+    size_t end = Index + 1 < m_OutBegin.size() ? m_OutBegin[Index + 1] : m_Out.size();
+    Count = end - m_OutBegin[Index];
+    return m_Out.data() + m_OutBegin[Index];
+}
+
+void PolygonUnion::Run()
+{
+    size_t n = m_Polys.size();
+    m_Merged.assign(n, false);
+    m_Neighbors.assign(n, std::vector<size_t>());
+    m_InSet.assign(n, false);
+    m_Splits.clear();
+    m_Out.clear();
+    m_OutBegin.clear();
+
+    m_EdgeSlabs.clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+        const Poly& p = m_Polys[i];
+        if (p.Count <= MIN_SLAB_EDGES)
+            continue;
+        std::vector<double> min_y(p.Count), max_y(p.Count);
+        for (size_t k = 0; k < p.Count; ++k)
+        {
+            double y0 = m_Points[p.Begin + k].imag();
+            double y1 = m_Points[p.Begin + (k + 1 < p.Count ? k + 1 : 0)].imag();
+            min_y[k] = std::min(y0, y1);
+            max_y[k] = std::max(y0, y1);
+        }
+        m_EdgeSlabs[i].Build(min_y, max_y);
+    }
+
+    std::vector<size_t> parent(n);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](size_t i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    // sweep over bounding boxes sorted by left edge
+    std::vector<size_t> order;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (m_Polys[i].Count != 0)
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(),
+              [this](size_t A, size_t B) { return m_Polys[A].MinX < m_Polys[B].MinX; });
+
+    for (size_t a = 0; a < order.size(); ++a)
+    {
+        const Poly& p = m_Polys[order[a]];
+        for (size_t b = a + 1; b < order.size(); ++b)
+        {
+            const Poly& q = m_Polys[order[b]];
+            if (q.MinX > p.MaxX)
+                break;
+            if (q.MinY > p.MaxY || q.MaxY < p.MinY)
+                continue;
+
+            size_t i = order[a], j = order[b];
+            if (Intersect(i, j) || Contains(j, m_Points[p.Begin]) ||
+                Contains(i, m_Points[q.Begin]))
+            {
+                parent[find(i)] = find(j);
+                m_Neighbors[i].push_back(j);
+                m_Neighbors[j].push_back(i);
+            }
+        }
+    }
+
+    std::sort(m_Splits.begin(), m_Splits.end(), [](const Split& A, const Split& B) {
+        return A.Edge < B.Edge || (A.Edge == B.Edge && A.T < B.T);
+    });
+
+    // groups in input order
+    std::map<size_t, std::vector<size_t>> groups;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!m_Neighbors[i].empty())
+            groups[find(i)].push_back(i);
+    }
+    std::vector<std::vector<size_t>> sorted;
+    for (auto& group : groups)
+        sorted.push_back(std::move(group.second));
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::vector<size_t>& A, const std::vector<size_t>& B) { return A[0] < B[0]; });
+
+    for (size_t g = 0; g < sorted.size(); ++g)
+        MergeGroup(sorted[g]);
+}
+
+bool PolygonUnion::Intersect(size_t P, size_t Q)
+{
+    const Poly& p = m_Polys[P];
+    const Poly& q = m_Polys[Q];
+
+    // only edges crossing the shared part of bounding boxes can intersect
+    double min_x = std::max(p.MinX, q.MinX);
+    double max_x = std::min(p.MaxX, q.MaxX);
+    double min_y = std::max(p.MinY, q.MinY);
+    double max_y = std::min(p.MaxY, q.MaxY);
+    auto in_box = [&](complex<double> A, complex<double> B) {
+        return std::max(A.real(), B.real()) >= min_x && std::min(A.real(), B.real()) <= max_x &&
+               std::max(A.imag(), B.imag()) >= min_y && std::min(A.imag(), B.imag()) <= max_y;
+    };
+
+    // edges of the larger polygon with slabs are only looked up in slabs crossed by edges
+    // of the other one
+    auto p_slabs = m_EdgeSlabs.find(P);
+    auto q_slabs = m_EdgeSlabs.find(Q);
+    if (p_slabs != m_EdgeSlabs.end() || q_slabs != m_EdgeSlabs.end())
+    {
+        bool q_large = q_slabs != m_EdgeSlabs.end() &&
+                       (p_slabs == m_EdgeSlabs.end() || q.Count >= p.Count);
+        const SlabIndex& slabs = q_large ? q_slabs->second : p_slabs->second;
+        const Poly& large = q_large ? q : p;
+        const Poly& small = q_large ? p : q;
+
+        bool touch = false;
+        for (size_t k = 0; k < small.Count; ++k)
+        {
+            size_t sa = small.Begin + k;
+            size_t sb = small.Begin + (k + 1 < small.Count ? k + 1 : 0);
+            if (!in_box(m_Points[sa], m_Points[sb]))
+                continue;
+            size_t first = slabs.Slab(std::min(m_Points[sa].imag(), m_Points[sb].imag()));
+            size_t last = slabs.Slab(std::max(m_Points[sa].imag(), m_Points[sb].imag()));
+            for (size_t s = first; s <= last; ++s)
+            {
+                for (const uint32_t* it = slabs.EdgesBegin(s); it != slabs.EdgesEnd(s); ++it)
+                {
+                    size_t la = large.Begin + *it;
+                    size_t lb = large.Begin + (*it + 1 < large.Count ? *it + 1 : 0);
+                    // each pair is tested in first slab both edges cross
+                    double min_y = std::min(m_Points[la].imag(), m_Points[lb].imag());
+                    if (std::max(first, slabs.Slab(min_y)) != s ||
+                        !in_box(m_Points[la], m_Points[lb]))
+                        continue;
+                    touch |= q_large ? IntersectEdges(sa, sb, la, lb)
+                                     : IntersectEdges(la, lb, sa, sb);
+                }
+            }
+        }
+        return touch;
+    }
+
+    std::vector<size_t> q_edges;
+    for (size_t k = 0; k < q.Count; ++k)
+    {
+        complex<double> a = m_Points[q.Begin + k];
+        complex<double> b = m_Points[q.Begin + (k + 1 < q.Count ? k + 1 : 0)];
+        if (in_box(a, b))
+            q_edges.push_back(k);
+    }
+    if (q_edges.empty())
+        return false;
+
+    bool touch = false;
+    for (size_t k = 0; k < p.Count; ++k)
+    {
+        size_t pa = p.Begin + k;
+        size_t pb = p.Begin + (k + 1 < p.Count ? k + 1 : 0);
+        if (!in_box(m_Points[pa], m_Points[pb]))
+            continue;
+        for (size_t e = 0; e < q_edges.size(); ++e)
+        {
+            size_t qa = q.Begin + q_edges[e];
+            size_t qb = q.Begin + (q_edges[e] + 1 < q.Count ? q_edges[e] + 1 : 0);
+            touch |= IntersectEdges(pa, pb, qa, qb);
+        }
+    }
+    return touch;
+}
+
+// true if edges cross or touch, crossing and touching points inside an edge split it
+bool PolygonUnion::IntersectEdges(size_t A0, size_t A1, size_t B0, size_t B1)
+{
+    complex<double> a0 = m_Points[A0], a1 = m_Points[A1];
+    complex<double> b0 = m_Points[B0], b1 = m_Points[B1];
+
+    double d1 = Misc::orient(a0, a1, b0);
+    double d2 = Misc::orient(a0, a1, b1);
+    double d3 = Misc::orient(b0, b1, a0);
+    double d4 = Misc::orient(b0, b1, a1);
+
+    if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)))
+    {
+        // same point is stored for both edges, so that their pieces connect exactly. It is
+        // taken from the lower end of edge A, so both edges of a zero width bridge are split
+        // at the same point.
+        double t = d3 / (d3 - d4);
+        complex<double> point = pt_less(a0, a1) ? a0 + (a1 - a0) * t
+                                                : a1 + (a0 - a1) * (d4 / (d4 - d3));
+        m_Splits.push_back(Split{A0, t, point, m_Owner[B0]});
+        m_Splits.push_back(Split{B0, d1 / (d1 - d2), point, m_Owner[A0]});
+        return true;
+    }
+
+    // end point of one edge lying on the other
+    bool touch = false;
+    auto on_edge = [&](size_t Edge, complex<double> S, complex<double> E, complex<double> P,
+                       size_t Other) {
+        if (P.real() < std::min(S.real(), E.real()) || P.real() > std::max(S.real(), E.real()) ||
+            P.imag() < std::min(S.imag(), E.imag()) || P.imag() > std::max(S.imag(), E.imag()))
+            return;
+        touch = true;
+        if (P == S || P == E)
+            return;
+        complex<double> dir = E - S;
+        double t = ((P - S) * std::conj(dir)).real() / std::norm(dir);
+        m_Splits.push_back(Split{Edge, t, P, m_Owner[Other]});
+    };
+    if (d1 == 0)
+        on_edge(A0, a0, a1, b0, B0);
+    if (d2 == 0)
+        on_edge(A0, a0, a1, b1, B0);
+    if (d3 == 0)
+        on_edge(B0, b0, b1, a0, A0);
+    if (d4 == 0)
+        on_edge(B0, b0, b1, a1, A0);
+    return touch;
+}
+
+// crossing number test, points on boundary may go either way
+bool PolygonUnion::Contains(size_t P, complex<double> Point) const
+{
+    const Poly& p = m_Polys[P];
+    if (Point.real() < p.MinX || Point.real() > p.MaxX || Point.imag() < p.MinY ||
+        Point.imag() > p.MaxY)
+        return false;
+
+    bool inside = false;
+    const complex<double>* points = &m_Points[p.Begin];
+    auto cross = [&](size_t Edge) {
+        complex<double> a = points[Edge];
+        complex<double> b = points[Edge + 1 < p.Count ? Edge + 1 : 0];
+        if ((a.imag() > Point.imag()) != (b.imag() > Point.imag()))
+        {
+            double x = a.real() + (Point.imag() - a.imag()) * (b.real() - a.real()) /
+                                      (b.imag() - a.imag());
+            if (Point.real() < x)
+                inside = !inside;
+        }
+    };
+
+    // only edges of the slab can span Point.imag()
+    auto slabs = m_EdgeSlabs.find(P);
+    if (slabs != m_EdgeSlabs.end())
+    {
+        size_t s = slabs->second.Slab(Point.imag());
+        for (const uint32_t* it = slabs->second.EdgesBegin(s); it != slabs->second.EdgesEnd(s);
+             ++it)
+            cross(*it);
+        return inside;
+    }
+    for (size_t i = 0; i < p.Count; ++i)
+        cross(i);
+    return inside;
+}
+
+void PolygonUnion::MergeGroup(const std::vector<size_t>& Members)
+{
+    std::vector<complex<double>> outline;
+    bool merged = false;
+    if (Members.size() <= MAX_GROUP)
+    {
+        // splits and neighbors from polygons out of group are ignored
+        for (size_t i = 0; i < Members.size(); ++i)
+            m_InSet[Members[i]] = true;
+        merged = UnionOutline(Members, outline);
+        for (size_t i = 0; i < Members.size(); ++i)
+            m_InSet[Members[i]] = false;
+    }
+
+    if (merged)
+        Emit(Members, outline);
+    else if (Members.size() > 2)
+        MergeHalves(Members);
+}
+
+// union of group is not one simple polygon (it has holes or runs into degenerate
+// geometry) or group is too large, group is split in two at the median along longer
+// side of its bounding box and connected parts of both halves are merged on their own
+void PolygonUnion::MergeHalves(const std::vector<size_t>& Members)
+{
+    double min_x = m_Polys[Members[0]].MinX, max_x = m_Polys[Members[0]].MaxX;
+    double min_y = m_Polys[Members[0]].MinY, max_y = m_Polys[Members[0]].MaxY;
+    for (size_t i = 1; i < Members.size(); ++i)
+    {
+        const Poly& p = m_Polys[Members[i]];
+        min_x = std::min(min_x, p.MinX);
+        max_x = std::max(max_x, p.MaxX);
+        min_y = std::min(min_y, p.MinY);
+        max_y = std::max(max_y, p.MaxY);
+    }
+    bool along_x = max_x - min_x >= max_y - min_y;
+
+    std::vector<size_t> sorted(Members);
+    size_t mid = sorted.size() / 2;
+    std::nth_element(sorted.begin(), sorted.begin() + mid, sorted.end(), [&](size_t A, size_t B) {
+        const Poly& a = m_Polys[A];
+        const Poly& b = m_Polys[B];
+        return along_x ? a.MinX + a.MaxX < b.MinX + b.MaxX : a.MinY + a.MaxY < b.MinY + b.MaxY;
+    });
+
+    for (size_t half = 0; half < 2; ++half)
+    {
+        std::vector<size_t>::iterator begin = sorted.begin() + (half == 0 ? 0 : mid);
+        std::vector<size_t>::iterator end = half == 0 ? sorted.begin() + mid : sorted.end();
+
+        // connected parts of the half
+        std::vector<std::vector<size_t>> parts;
+        for (auto it = begin; it != end; ++it)
+            m_InSet[*it] = true;
+        for (auto it = begin; it != end; ++it)
+        {
+            if (!m_InSet[*it])
+                continue;
+            std::vector<size_t> part(1, *it);
+            m_InSet[*it] = false;
+            for (size_t head = 0; head < part.size(); ++head)
+            {
+                const std::vector<size_t>& next = m_Neighbors[part[head]];
+                for (size_t i = 0; i < next.size(); ++i)
+                {
+                    if (m_InSet[next[i]])
+                    {
+                        m_InSet[next[i]] = false;
+                        part.push_back(next[i]);
+                    }
+                }
+            }
+            if (part.size() > 1)
+                parts.push_back(std::move(part));
+        }
+
+        for (size_t i = 0; i < parts.size(); ++i)
+            MergeGroup(parts[i]);
+    }
+}
+
+bool PolygonUnion::UnionOutline(const std::vector<size_t>& Members,
+                                std::vector<complex<double>>& Out)
+{
+    // split edges at crossings
+    std::vector<SubEdge> edges;
+    for (size_t m = 0; m < Members.size(); ++m)
+    {
+        const Poly& p = m_Polys[Members[m]];
+        // splits are sorted by edge, edges of polygon follow each other
+        auto split = std::lower_bound(m_Splits.begin(), m_Splits.end(), p.Begin,
+                                      [](const Split& S, size_t Edge) { return S.Edge < Edge; });
+        for (size_t k = 0; k < p.Count; ++k)
+        {
+            size_t edge = p.Begin + k;
+            complex<double> prev = m_Points[edge];
+            complex<double> end = m_Points[p.Begin + (k + 1 < p.Count ? k + 1 : 0)];
+
+            for (; split != m_Splits.end() && split->Edge == edge; ++split)
+            {
+                if (!m_InSet[split->Other] || split->Point == prev || split->Point == end)
+                    continue;
+                edges.push_back(SubEdge{prev, split->Point, Members[m]});
+                prev = split->Point;
+            }
+            edges.push_back(SubEdge{prev, end, Members[m]});
+        }
+    }
+
+    // pieces lying on top of each other: same direction - outline of both polygons,
+    // one is kept; opposite direction - polygons are on both sides, both are dropped,
+    // unless the pair is a zero width bridge of one polygon to its hole
+    struct EdgeKey {
+        complex<double> Low;
+        complex<double> High;
+        size_t Edge;
+    };
+    std::vector<EdgeKey> order(edges.size());
+    for (size_t e = 0; e < edges.size(); ++e)
+    {
+        bool forward = pt_less(edges[e].Start, edges[e].End);
+        order[e].Low = forward ? edges[e].Start : edges[e].End;
+        order[e].High = forward ? edges[e].End : edges[e].Start;
+        order[e].Edge = e;
+    }
+    std::sort(order.begin(), order.end(), [](const EdgeKey& A, const EdgeKey& B) {
+        if (A.Low != B.Low)
+            return pt_less(A.Low, B.Low);
+        return pt_less(A.High, B.High);
+    });
+
+    std::vector<bool> keep(edges.size(), true);
+    // polygons sharing kept piece, its midpoint is on their boundary
+    std::vector<std::pair<size_t, size_t>> shared(edges.size(), std::make_pair(0, 0));
+    for (size_t i = 0; i < order.size();)
+    {
+        size_t j = i + 1;
+        while (j < order.size() && order[j].Low == order[i].Low && order[j].High == order[i].High)
+            j++;
+        if (j - i > 1)
+        {
+            const complex<double>& start = edges[order[i].Edge].Start;
+            bool opposite = false;
+            for (size_t k = i + 1; k < j; ++k)
+                opposite |= edges[order[k].Edge].Start != start;
+            bool bridge = opposite && j - i == 2 &&
+                          edges[order[i].Edge].Owner == edges[order[i + 1].Edge].Owner;
+            if (!bridge)
+            {
+                for (size_t k = opposite ? i : i + 1; k < j; ++k)
+                    keep[order[k].Edge] = false;
+                shared[order[i].Edge] = std::make_pair(i, j);
+            }
+        }
+        i = j;
+    }
+
+    // pieces inside other polygons are not part of union outline, pieces of one polygon
+    // follow each other
+    std::vector<size_t> next;
+    for (size_t e = 0; e < edges.size(); ++e)
+    {
+        if (e == 0 || edges[e].Owner != edges[e - 1].Owner)
+        {
+            const std::vector<size_t>& all = m_Neighbors[edges[e].Owner];
+            next.clear();
+            for (size_t i = 0; i < all.size(); ++i)
+            {
+                if (m_InSet[all[i]])
+                    next.push_back(all[i]);
+            }
+        }
+        if (!keep[e])
+            continue;
+        complex<double> mid = (edges[e].Start + edges[e].End) / 2.0;
+        for (size_t i = 0; i < next.size(); ++i)
+        {
+            bool is_shared = false;
+            for (size_t k = shared[e].first; k < shared[e].second; ++k)
+                is_shared |= edges[order[k].Edge].Owner == next[i];
+            if (!is_shared && Contains(next[i], mid))
+            {
+                keep[e] = false;
+                break;
+            }
+        }
+    }
+
+    // pieces left are the union outline and its holes, holes are bridged to the outline
+    // again, as a trace can cover the bridge of a zone or close a new hole
+    std::vector<SubEdge> boundary;
+    for (size_t e = 0; e < edges.size(); ++e)
+    {
+        if (keep[e])
+            boundary.push_back(edges[e]);
+    }
+    if (boundary.size() < 3)
+        return false;
+    std::stable_sort(boundary.begin(), boundary.end(), [](const SubEdge& A, const SubEdge& B) {
+        return pt_less(A.Start, B.Start);
+    });
+
+    // several outer outlines are separate parts and make bridge_holes fail
+    std::vector<std::vector<complex<double>>> cycles;
+    Out.clear();
+    if (!trace_cycles(boundary, cycles) || !bridge_holes(cycles, Out))
+        return false;
+    return Out.size() >= 3 && signed_area(Out.data(), Out.size()) > 0;
+}
+
+void PolygonUnion::Emit(const std::vector<size_t>& Members,
+                        const std::vector<complex<double>>& Outline)
+{
+    for (size_t i = 0; i < Members.size(); ++i)
+        m_Merged[Members[i]] = true;
+    m_OutBegin.push_back(m_Out.size());
+    m_Out.insert(m_Out.end(), Outline.begin(), Outline.end());
+}
+
+void SlabIndex::Build(const std::vector<double>& MinY, const std::vector<double>& MaxY)
+{
+    size_t count = MinY.size();
+    m_MinY = 0;
+    m_SlabHeight = 1;
+    if (count > 0)
+    {
+        m_MinY = *std::min_element(MinY.begin(), MinY.end());
+        double max_y = *std::max_element(MaxY.begin(), MaxY.end());
+        if (max_y > m_MinY)
+            m_SlabHeight = (max_y - m_MinY) / (count / 8 + 1);
+    }
+    size_t slabs = count / 8 + 1;
+
+    // count edges of each slab, then fill them in
+    m_SlabBegin.assign(slabs + 1, 0);
+    m_SlabEdges.clear();
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        std::vector<uint32_t> fill(m_SlabBegin.begin(), m_SlabBegin.end() - 1);
+        if (pass == 1)
+            m_SlabEdges.resize(m_SlabBegin[slabs]);
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t last = Slab(MaxY[i]);
+            for (size_t s = Slab(MinY[i]); s <= last; ++s)
+            {
+                if (pass == 0)
+                    m_SlabBegin[s + 1]++;
+                else
+                    m_SlabEdges[fill[s]++] = i;
+            }
+        }
+        if (pass == 0)
+        {
+            for (size_t s = 0; s < slabs; ++s)
+                m_SlabBegin[s + 1] += m_SlabBegin[s];
+        }
+    }
+}
+
+size_t SlabIndex::Slab(double Y) const
+{
+    double slab = std::floor((Y - m_MinY) / m_SlabHeight);
+    size_t last = m_SlabBegin.size() - 2;
+    if (!(slab > 0))
+        return 0;
+    return std::min(last, (size_t)slab);
+}
+
+SlabPolygon::SlabPolygon(const complex<double>* Outline, size_t Count)
+    : m_Points(Outline, Outline + Count), m_MinX(0), m_MinY(0), m_MaxX(0), m_MaxY(0)
+{
+    if (Count < 3)
+    {
+        m_Points.clear();
+        return;
+    }
+
+    m_MinX = m_MaxX = Outline[0].real();
+    m_MinY = m_MaxY = Outline[0].imag();
+    for (size_t i = 1; i < Count; ++i)
+    {
+        m_MinX = std::min(m_MinX, Outline[i].real());
+        m_MaxX = std::max(m_MaxX, Outline[i].real());
+        m_MinY = std::min(m_MinY, Outline[i].imag());
+        m_MaxY = std::max(m_MaxY, Outline[i].imag());
+    }
+
+    std::vector<double> min_y(Count), max_y(Count);
+    for (size_t i = 0; i < Count; ++i)
+    {
+        double y0 = Outline[i].imag();
+        double y1 = Outline[i + 1 < Count ? i + 1 : 0].imag();
+        min_y[i] = std::min(y0, y1);
+        max_y[i] = std::max(y0, y1);
+    }
+    m_Slabs.Build(min_y, max_y);
+}
+
+bool SlabPolygon::Contains(complex<double> Point) const
+{
+    if (m_Points.empty() || Point.real() < m_MinX || Point.real() > m_MaxX ||
+        Point.imag() < m_MinY || Point.imag() > m_MaxY)
+        return false;
+
+    // crossing number over edges of the slab only, other edges don't span Point.imag()
+    bool inside = false;
+    size_t s = m_Slabs.Slab(Point.imag());
+    size_t count = m_Points.size();
+    for (const uint32_t* it = m_Slabs.EdgesBegin(s); it != m_Slabs.EdgesEnd(s); ++it)
+    {
+        size_t i = *it;
+        complex<double> a = m_Points[i];
+        complex<double> b = m_Points[i + 1 < count ? i + 1 : 0];
+        if ((a.imag() > Point.imag()) != (b.imag() > Point.imag()))
+        {
+            double x = a.real() + (Point.imag() - a.imag()) * (b.real() - a.real()) /
+                                      (b.imag() - a.imag());
+            if (Point.real() < x)
+                inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool SlabPolygon::Contains(const complex<double>* Outline, size_t Count) const
+{
+    if (m_Points.empty() || Count == 0)
+        return false;
+
+    double min_y = Outline[0].imag(), max_y = Outline[0].imag();
+    for (size_t i = 0; i < Count; ++i)
+    {
+        if (!Contains(Outline[i]))
+            return false;
+        min_y = std::min(min_y, Outline[i].imag());
+        max_y = std::max(max_y, Outline[i].imag());
+    }
+
+    // all points are inside, outline is inside unless it crosses or touches the boundary
+    size_t count = m_Points.size();
+    for (size_t s = m_Slabs.Slab(min_y); s <= m_Slabs.Slab(max_y); ++s)
+    {
+        for (const uint32_t* it = m_Slabs.EdgesBegin(s); it != m_Slabs.EdgesEnd(s); ++it)
+        {
+            size_t e = *it;
+            complex<double> a0 = m_Points[e];
+            complex<double> a1 = m_Points[e + 1 < count ? e + 1 : 0];
+            for (size_t i = 0; i < Count; ++i)
+            {
+                if (Misc::lines_intersect(a0, a1, Outline[i], Outline[i + 1 < Count ? i + 1 : 0]))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+PolygonOffset::PolygonOffset(JoinType Join, size_t ArcSteps, double MiterLimit, double Tolerance)
+    : m_Join(Join),
+      m_ArcSteps(ArcSteps == 0 ? 1 : ArcSteps),
+      m_MiterLimit(MiterLimit),
+      m_Tolerance(Tolerance)
+{}
+
+bool PolygonOffset::Run(const complex<double>* Outline,
+                        size_t Count,
+                        double Distance,
+                        std::vector<complex<double>>& Out)
+{
+    Out.clear();
+    m_Raw.clear();
+    m_Splits.clear();
+    m_Boundary.clear();
+    m_Cycles.clear();
+
+    // counter clockwise outline without points closer than tolerance
+    std::vector<complex<double>> outline;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        if (outline.empty() || std::abs(outline.back() - Outline[i]) > m_Tolerance)
+            outline.push_back(Outline[i]);
+    }
+    while (outline.size() > 1 && std::abs(outline.back() - outline[0]) <= m_Tolerance)
+        outline.pop_back();
+    if (outline.size() < 3)
+        return false;
+    double area = signed_area(outline.data(), outline.size());
+    if (area == 0)
+        return false;
+    if (area < 0)
+        std::reverse(outline.begin(), outline.end());
+
+    if (!(Distance > 0))
+    {
+        Out = outline;
+        return true;
+    }
+
+    // rounding both coordinates moves a vertex of a smooth outline a few Tolerance off
+    // the chord of its neighbours, such notches would leave spurious loops in the offset
+    remove_notches(outline, 4 * m_Tolerance);
+    if (outline.size() < 3)
+        return false;
+
+    RawOutline(outline, Distance);
+    if (m_Raw.size() < 3)
+        return false;
+    SplitRaw();
+    FindBoundary();
+    if (!trace_cycles(m_Boundary, m_Cycles))
+        return false;
+    return bridge_holes(m_Cycles, Out);
+}
+
+// point where edges offset along unit normals Nu and Nv meet, Dot - cosine of angle between
+// normals; exact for right angles, so that it stays in line with straight offset edges
+static complex<double> miter_point(complex<double> Center,
+                                   complex<double> Nu,
+                                   complex<double> Nv,
+                                   double Dot,
+                                   double Distance)
+{
+    return Center + (Nu + Nv) * (Distance / (1 + Dot));
+}
+
+void PolygonOffset::RawOutline(const std::vector<complex<double>>& Outline, double Distance)
+{
+    size_t count = Outline.size();
+    double step = M_PI / m_ArcSteps;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        complex<double> prev = Outline[i == 0 ? count - 1 : i - 1];
+        complex<double> center = Outline[i];
+        complex<double> next = Outline[i + 1 < count ? i + 1 : 0];
+
+        complex<double> u = (center - prev) / std::abs(center - prev);
+        complex<double> v = (next - center) / std::abs(next - center);
+        // outward normals are on the right of counter clockwise outline
+        complex<double> nu(u.imag(), -u.real());
+        complex<double> nv(v.imag(), -v.real());
+        double cross = u.real() * v.imag() - u.imag() * v.real();
+        double dot = u.real() * v.real() + u.imag() * v.imag();
+
+        if (std::fabs(cross) <= 1e-12 && dot > 0)
+        {
+            // straight
+            m_Raw.push_back(center + nu * Distance);
+        }
+        else if (cross < 0)
+        {
+            // concave corner, offset edges meet on bisector of normals unless that is
+            // more than half way along one of them, then they are joined by a loop through
+            // center which is removed with other overlaps
+            double reach = Distance * std::sqrt((1 - dot) / (1 + dot));
+            if (2 * reach <= std::min(std::abs(center - prev), std::abs(next - center)))
+                m_Raw.push_back(miter_point(center, nu, nv, dot, Distance));
+            else
+            {
+                m_Raw.push_back(center + nu * Distance);
+                m_Raw.push_back(center);
+                m_Raw.push_back(center + nv * Distance);
+            }
+        }
+        else if (m_Join == JOIN_ROUND)
+        {
+            // normals turn counter clockwise from nu to nv
+            double angle = std::atan2(cross, dot);
+            if (angle <= 0)
+                angle = M_PI;
+            // turn smaller than one arc step whose miter point is no further out than
+            // chords of a full step are inside
+            double cos_half = std::sqrt((1 + dot) / 2);
+            if (angle < step && 1 / cos_half - 1 <= 1 - std::cos(step / 2))
+            {
+                m_Raw.push_back(miter_point(center, nu, nv, dot, Distance));
+                continue;
+            }
+            size_t steps = (size_t)std::ceil(angle / step - 1e-9);
+            m_Raw.push_back(center + nu * Distance);
+            for (size_t k = 1; k < steps; ++k)
+            {
+                double a = angle * k / steps;
+                complex<double> r(std::cos(a), std::sin(a));
+                complex<double> n(nu.real() * r.real() - nu.imag() * r.imag(),
+                                  nu.real() * r.imag() + nu.imag() * r.real());
+                m_Raw.push_back(center + n * Distance);
+            }
+            m_Raw.push_back(center + nv * Distance);
+        }
+        else
+        {
+            // miter point, beveled if too far from corner
+            if ((1 + dot) * m_MiterLimit * m_MiterLimit >= 2)
+            {
+                m_Raw.push_back(miter_point(center, nu, nv, dot, Distance));
+            }
+            else
+            {
+                m_Raw.push_back(center + nu * Distance);
+                m_Raw.push_back(center + nv * Distance);
+            }
+        }
+    }
+
+    // zero length edges
+    std::vector<complex<double>> raw;
+    for (size_t i = 0; i < m_Raw.size(); ++i)
+    {
+        if (raw.empty() || raw.back() != m_Raw[i])
+            raw.push_back(m_Raw[i]);
+    }
+    while (raw.size() > 1 && raw.back() == raw[0])
+        raw.pop_back();
+    m_Raw.swap(raw);
+
+    size_t edges = m_Raw.size();
+    std::vector<double> min_y(edges), max_y(edges);
+    for (size_t i = 0; i < edges; ++i)
+    {
+        double y0 = m_Raw[i].imag();
+        double y1 = m_Raw[i + 1 < edges ? i + 1 : 0].imag();
+        min_y[i] = std::min(y0, y1);
+        max_y[i] = std::max(y0, y1);
+    }
+    m_RawSlabs.Build(min_y, max_y);
+}
+
+void PolygonOffset::SplitRaw()
+{
+    size_t count = m_Raw.size();
+    std::vector<size_t> first_slab(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        double y0 = m_Raw[i].imag();
+        double y1 = m_Raw[i + 1 < count ? i + 1 : 0].imag();
+        first_slab[i] = m_RawSlabs.Slab(std::min(y0, y1));
+    }
+
+    for (size_t s = 0; s < m_RawSlabs.SlabCount(); ++s)
+    {
+        const uint32_t* begin = m_RawSlabs.EdgesBegin(s);
+        const uint32_t* end = m_RawSlabs.EdgesEnd(s);
+        for (const uint32_t* it = begin; it != end; ++it)
+        {
+            size_t i = *it;
+            complex<double> a0 = m_Raw[i];
+            complex<double> a1 = m_Raw[i + 1 < count ? i + 1 : 0];
+            for (const uint32_t* jt = it + 1; jt != end; ++jt)
+            {
+                size_t j = *jt;
+                // each pair is tested in first slab both edges cross
+                if (std::max(first_slab[i], first_slab[j]) != s)
+                    continue;
+                complex<double> b0 = m_Raw[j];
+                complex<double> b1 = m_Raw[j + 1 < count ? j + 1 : 0];
+                if (std::max(a0.real(), a1.real()) < std::min(b0.real(), b1.real()) ||
+                    std::max(b0.real(), b1.real()) < std::min(a0.real(), a1.real()))
+                    continue;
+
+                // end points closer than tolerance to the other edge split it there, also
+                // covers collinear overlaps
+                double len_a = std::abs(a1 - a0);
+                double len_b = std::abs(b1 - b0);
+                double d1 = Misc::orient(a0, a1, b0);
+                double d2 = Misc::orient(a0, a1, b1);
+                double d3 = Misc::orient(b0, b1, a0);
+                double d4 = Misc::orient(b0, b1, a1);
+                bool b0_on = std::fabs(d1) <= m_Tolerance * len_a;
+                bool b1_on = std::fabs(d2) <= m_Tolerance * len_a;
+                bool a0_on = std::fabs(d3) <= m_Tolerance * len_b;
+                bool a1_on = std::fabs(d4) <= m_Tolerance * len_b;
+                if (b0_on || b1_on || a0_on || a1_on)
+                {
+                    if (b0_on)
+                        SplitAt(i, a0, a1, b0);
+                    if (b1_on)
+                        SplitAt(i, a0, a1, b1);
+                    if (a0_on)
+                        SplitAt(j, b0, b1, a0);
+                    if (a1_on)
+                        SplitAt(j, b0, b1, a1);
+                    continue;
+                }
+
+                if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
+                    ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)))
+                {
+                    double t = d3 / (d3 - d4);
+                    complex<double> point = a0 + (a1 - a0) * t;
+                    m_Splits.push_back(Split{i, t, point});
+                    m_Splits.push_back(Split{j, d1 / (d1 - d2), point});
+                }
+            }
+        }
+    }
+
+    std::sort(m_Splits.begin(), m_Splits.end(), [](const Split& A, const Split& B) {
+        return A.Edge < B.Edge || (A.Edge == B.Edge && A.T < B.T);
+    });
+}
+
+void PolygonOffset::SplitAt(size_t Edge,
+                            complex<double> A0,
+                            complex<double> A1,
+                            complex<double> Point)
+{
+    // points near edge ends are the ends themselves
+    double t = edge_param(A0, A1, Point);
+    double margin = m_Tolerance / std::abs(A1 - A0);
+    if (t > margin && t < 1 - margin)
+        m_Splits.push_back(Split{Edge, t, Point});
+}
+
+int PolygonOffset::Winding(complex<double> Point) const
+{
+    // signed crossings of ray to the right, counter clockwise outline winds +1
+    int winding = 0;
+    size_t count = m_Raw.size();
+    size_t s = m_RawSlabs.Slab(Point.imag());
+    for (const uint32_t* it = m_RawSlabs.EdgesBegin(s); it != m_RawSlabs.EdgesEnd(s); ++it)
+    {
+        size_t i = *it;
+        complex<double> a = m_Raw[i];
+        complex<double> b = m_Raw[i + 1 < count ? i + 1 : 0];
+        if ((a.imag() > Point.imag()) != (b.imag() > Point.imag()))
+        {
+            double x = a.real() + (Point.imag() - a.imag()) * (b.real() - a.real()) /
+                                      (b.imag() - a.imag());
+            if (Point.real() < x)
+                winding += b.imag() > a.imag() ? 1 : -1;
+        }
+    }
+    return winding;
+}
+
+void PolygonOffset::FindBoundary()
+{
+    double min_x = m_Raw[0].real(), max_x = min_x;
+    double min_y = m_Raw[0].imag(), max_y = min_y;
+    for (size_t i = 1; i < m_Raw.size(); ++i)
+    {
+        min_x = std::min(min_x, m_Raw[i].real());
+        max_x = std::max(max_x, m_Raw[i].real());
+        min_y = std::min(min_y, m_Raw[i].imag());
+        max_y = std::max(max_y, m_Raw[i].imag());
+    }
+    // distance of winding test points from tested edge, below snapping tolerance
+    double eps = std::min(1e-9 * std::max(max_x - min_x, max_y - min_y), m_Tolerance / 4);
+
+    size_t count = m_Raw.size();
+    size_t split = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        complex<double> start = m_Raw[i];
+        complex<double> edge_end = m_Raw[i + 1 < count ? i + 1 : 0];
+        while (true)
+        {
+            complex<double> end = edge_end;
+            if (split < m_Splits.size() && m_Splits[split].Edge == i)
+                end = m_Splits[split++].Point;
+            if (end == start)
+                continue;
+
+            complex<double> dir = (end - start) / std::abs(end - start);
+            complex<double> mid = (start + end) * 0.5;
+            complex<double> left(-dir.imag(), dir.real());
+            bool left_in = Winding(mid + left * eps) > 0;
+            bool right_in = Winding(mid - left * eps) > 0;
+            if (left_in && !right_in)
+                m_Boundary.push_back(SubEdge{start, end});
+            else if (right_in && !left_in)
+                m_Boundary.push_back(SubEdge{end, start});
+
+            if (end == edge_end)
+                break;
+            start = end;
+        }
+    }
+
+    SnapBoundary();
+
+    // overlapping edges running the same way are kept once
+    std::sort(m_Boundary.begin(), m_Boundary.end(), [](const SubEdge& A, const SubEdge& B) {
+        return pt_less(A.Start, B.Start) || (A.Start == B.Start && pt_less(A.End, B.End));
+    });
+    m_Boundary.erase(std::unique(m_Boundary.begin(), m_Boundary.end(),
+                                 [](const SubEdge& A, const SubEdge& B) {
+                                     return A.Start == B.Start && A.End == B.End;
+                                 }),
+                     m_Boundary.end());
+}
+
+void PolygonOffset::SnapBoundary()
+{
+    // end points closer than tolerance are replaced by the first of them in x order
+    std::vector<complex<double>*> points;
+    for (size_t i = 0; i < m_Boundary.size(); ++i)
+    {
+        points.push_back(&m_Boundary[i].Start);
+        points.push_back(&m_Boundary[i].End);
+    }
+    std::sort(points.begin(), points.end(),
+              [](const complex<double>* A, const complex<double>* B) { return pt_less(*A, *B); });
+
+    std::vector<bool> snapped(points.size(), false);
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        if (snapped[i])
+            continue;
+        complex<double> anchor = *points[i];
+        for (size_t j = i + 1;
+             j < points.size() && points[j]->real() - anchor.real() <= m_Tolerance; ++j)
+        {
+            if (!snapped[j] && std::abs(*points[j] - anchor) <= m_Tolerance)
+            {
+                *points[j] = anchor;
+                snapped[j] = true;
+            }
+        }
+    }
+
+    // edges shorter than tolerance are gone
+    m_Boundary.erase(std::remove_if(m_Boundary.begin(), m_Boundary.end(),
+                                    [](const SubEdge& E) { return E.Start == E.End; }),
+                     m_Boundary.end());
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ems_union_h
+#define ems_union_h
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace kicad_to_ems
+{
+namespace pems
+{
+
+/**
+    @brief Edges sorted into horizontal slabs
+
+    Edge list of a slab holds every edge whose y range overlaps the slab, so horizontal
+    rays and edges of nearby rows only have to be tested against edges of a few slabs.
+*/
+class SlabIndex
+{
+public:
+    // edges are given by their y ranges, about eight edges per slab
+    void Build(const std::vector<double>& MinY, const std::vector<double>& MaxY);
+
+    size_t Slab(double Y) const;
+    size_t SlabCount() const { return m_SlabBegin.size() - 1; }
+    const uint32_t* EdgesBegin(size_t Index) const
+    {
+        return m_SlabEdges.data() + m_SlabBegin[Index];
+    }
+    const uint32_t* EdgesEnd(size_t Index) const
+    {
+        return m_SlabEdges.data() + m_SlabBegin[Index + 1];
+    }
+
+private:
+    double m_MinY = 0;
+    double m_SlabHeight = 1;
+    // edges (index) crossing each slab
+    std::vector<uint32_t> m_SlabBegin;
+    std::vector<uint32_t> m_SlabEdges;
+};
+
+/**
+    @brief Union of overlapping simple polygons
+
+    Run() finds groups of overlapping or touching polygons and replaces each group
+    with outline of its union. Extruded polygons can't have holes, so holes are connected
+    to the outline with zero width bridges, as KiCad stores filled zones. A group whose
+    union falls apart is split in halves until the parts can be merged. Polygons that
+    can't be merged are left as is.
+*/
+class PolygonUnion
+{
+public:
+    void Add(const std::complex<double>* Outline, size_t Count);
+    void Run();
+
+    size_t Size() const { return m_Polys.size(); }
+    // input polygon is replaced by one of merged polygons
+    bool IsMerged(size_t Input) const { return m_Merged[Input]; }
+    size_t MergedCount() const { return m_OutBegin.size(); }
+    const std::complex<double>* GetMerged(size_t Index, size_t& Count) const;
+
+private:
+    // larger groups are split before merge, their union outline is rarely one simple
+    // polygon and one failed attempt would cost as much as merging all of its parts
+    static const size_t MAX_GROUP = 256;
+    // polygons with more edges (zones) get slabs, so that small polygons overlapping them
+    // are only tested against nearby edges
+    static const size_t MIN_SLAB_EDGES = 64;
+
+    struct Poly {
+        size_t Begin;
+        size_t Count;
+        double MinX, MinY, MaxX, MaxY;
+    };
+    // point where edge (index of its first vertex) is crossed or touched by edge of
+    // polygon Other
+    struct Split {
+        size_t Edge;
+        double T;
+        std::complex<double> Point;
+        size_t Other;
+    };
+    struct SubEdge {
+        std::complex<double> Start;
+        std::complex<double> End;
+        size_t Owner;
+    };
+
+    // counter clockwise outlines without repeated consecutive points, holes of zones are
+    // bridged to their outline; polygons with less than three points or zero area have
+    // Count 0 and are never merged
+    std::vector<std::complex<double>> m_Points;
+    std::vector<Poly> m_Polys;
+    // polygon of each point
+    std::vector<size_t> m_Owner;
+    std::vector<Split> m_Splits;
+    // edge slabs of large polygons
+    std::map<size_t, SlabIndex> m_EdgeSlabs;
+    // polygons crossing, touching or containing polygon
+    std::vector<std::vector<size_t>> m_Neighbors;
+    std::vector<bool> m_Merged;
+    // polygons of group being merged
+    std::vector<bool> m_InSet;
+
+    std::vector<std::complex<double>> m_Out;
+    std::vector<size_t> m_OutBegin;
+
+    bool Intersect(size_t P, size_t Q);
+    // edges given by indices of their end points, edge is known by its first point
+    bool IntersectEdges(size_t A0, size_t A1, size_t B0, size_t B1);
+    bool Contains(size_t P, std::complex<double> Point) const;
+
+    void MergeGroup(const std::vector<size_t>& Members);
+    void MergeHalves(const std::vector<size_t>& Members);
+    bool UnionOutline(const std::vector<size_t>& Members, std::vector<std::complex<double>>& Out);
+    void Emit(const std::vector<size_t>& Members, const std::vector<std::complex<double>>& Outline);
+};
+
+/**
+    @brief Polygon with edges sorted into horizontal slabs for containment tests
+
+    Point and polygon tests only look at edges of slabs the tested points fall in,
+    so large polygons (zones) can be tested against many small ones.
+*/
+class SlabPolygon
+{
+public:
+    SlabPolygon(const std::complex<double>* Outline, size_t Count);
+
+    // points on boundary may go either way
+    bool Contains(std::complex<double> Point) const;
+    // whole outline is inside, outlines don't touch or cross
+    bool Contains(const std::complex<double>* Outline, size_t Count) const;
+
+private:
+    std::vector<std::complex<double>> m_Points;
+    double m_MinX, m_MinY, m_MaxX, m_MaxY;
+    // edge is known by index of its first point
+    SlabIndex m_Slabs;
+};
+
+/**
+    @brief Outward offset of polygon outline
+
+    Edges are moved out by offset distance and joined with arcs or mitered corners. Parts
+    of this raw outline that fold over are dropped by tracing the outline of the area it
+    winds around. Holes of the result are connected to the outer outline with zero width
+    bridges, the same way KiCad stores filled zones, so the result is one polygon.
+*/
+class PolygonOffset
+{
+public:
+    enum JoinType
+    {
+        JOIN_ROUND,
+        JOIN_MITER
+    };
+
+    // ArcSteps - steps per half circle of round joins, miter joins longer than MiterLimit
+    // times offset distance are beveled. Notches of the outline a few Tolerance deep are
+    // filled and points of the offset outline closer than Tolerance are merged (KiCad
+    // coordinates are whole nanometers).
+    PolygonOffset(JoinType Join,
+                  size_t ArcSteps,
+                  double MiterLimit = 2.0,
+                  double Tolerance = 1e-6);
+
+    // counter clockwise outline of Outline offset by Distance, false if outline is
+    // degenerate or offset outline can't be resolved to one polygon
+    bool Run(const std::complex<double>* Outline,
+             size_t Count,
+             double Distance,
+             std::vector<std::complex<double>>& Out);
+
+private:
+    // point where raw edge (index of its first point) is crossed or touched by other edge
+    struct Split {
+        size_t Edge;
+        double T;
+        std::complex<double> Point;
+    };
+    struct SubEdge {
+        std::complex<double> Start;
+        std::complex<double> End;
+    };
+
+    JoinType m_Join;
+    size_t m_ArcSteps;
+    double m_MiterLimit;
+    double m_Tolerance;
+
+    std::vector<std::complex<double>> m_Raw;
+    SlabIndex m_RawSlabs;
+    std::vector<Split> m_Splits;
+    // parts of raw edges with offset area on the left and no area on the right
+    std::vector<SubEdge> m_Boundary;
+    // closed outlines traced from boundary, outer one counter clockwise, holes clockwise
+    std::vector<std::vector<std::complex<double>>> m_Cycles;
+
+    void RawOutline(const std::vector<std::complex<double>>& Outline, double Distance);
+    void SplitRaw();
+    // split raw edge A0 A1 at Point unless Point is within tolerance of its ends
+    void SplitAt(size_t Edge,
+                 std::complex<double> A0,
+                 std::complex<double> A1,
+                 std::complex<double> Point);
+    int Winding(std::complex<double> Point) const;
+    void FindBoundary();
+    // merge boundary end points closer than tolerance
+    void SnapBoundary();
+};
+
+} // namespace pems
+} // namespace kicad_to_ems
+
+#endif // ems_union_h
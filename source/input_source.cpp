@@ -0,0 +1,123 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "input_source.hpp"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace kicad_to_ems::srecs;
+
+class input_exc : public std::runtime_error
+{
+public:
+    input_exc(const std::string& Msg) : std::runtime_error(Msg) {}
+};
+
+InputSource::InputSource(const char* FileName)
+    : m_Begin(nullptr), m_End(nullptr), m_Mapping(nullptr), m_MappingSize(0)
+{
+    if (strcmp(FileName, "-") == 0)
+    {
+        ReadStream(stdin);
+        return;
+    }
+
+    if (MapFile(FileName))
+        return;
+
+    // file is closed also if reading throws
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> stream(std::fopen(FileName, "rb"),
+                                                              &std::fclose);
+    if (stream == nullptr)
+        throw input_exc(std::string("Can't open input file: ") + FileName);
+    ReadStream(stream.get());
+}
+
+InputSource::~InputSource()
+{
+#ifndef _WIN32
+    if (m_Mapping != nullptr)
+        munmap(m_Mapping, m_MappingSize);
+#endif
+}
+
+bool InputSource::MapFile(const char* FileName)
+{
+#ifndef _WIN32
+    int fd = open(FileName, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    // only regular, non empty files can be mapped
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    // file is parsed front to back
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    m_Mapping = mapping;
+    m_MappingSize = st.st_size;
+    m_Begin = static_cast<const char*>(mapping);
+    m_End = m_Begin + m_MappingSize;
+    return true;
+#else
+    (void)FileName;
+    return false;
+#endif
+}
+
+void InputSource::ReadStream(std::FILE* Stream)
+{
+    const size_t chunk = 1 << 16;
+    size_t used = 0;
+
+    while (true)
+    {
+        m_Buffer.resize(used + chunk);
+        size_t n = std::fread(m_Buffer.data() + used, 1, chunk, Stream);
+        used += n;
+        if (n < chunk)
+            break;
+    }
+    if (std::ferror(Stream))
+        throw input_exc("Input file read failed");
+
+    m_Buffer.resize(used);
+    m_Begin = m_Buffer.data();
+    m_End = m_Begin + used;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef input_source_h
+#define input_source_h
+
+#include <vector>
+#include <cstddef>
+#include <cstdio>
+
+namespace kicad_to_ems
+{
+namespace srecs
+{
+
+/**
+    @brief Read-only view of a whole input file
+
+    Regular files are memory mapped and parsed in place. Pipes, character devices
+    and "-" (stdin) can't be mapped, for those the data is read into a buffer.
+*/
+class InputSource
+{
+public:
+    explicit InputSource(const char* FileName);
+    ~InputSource();
+
+    InputSource(const InputSource&) = delete;
+    InputSource& operator=(const InputSource&) = delete;
+
+    const char* Begin() const { return m_Begin; }
+    const char* End() const { return m_End; }
+    size_t Size() const { return m_End - m_Begin; }
+    bool IsMapped() const { return m_Mapping != nullptr; }
+
+private:
+    const char* m_Begin;
+    const char* m_End;
+    void* m_Mapping;
+    size_t m_MappingSize;
+    std::vector<char> m_Buffer;
+
+    bool MapFile(const char* FileName);
+    void ReadStream(std::FILE* Stream);
+};
+
+} // namespace srecs
+} // namespace kicad_to_ems
+
+#endif // input_source_h
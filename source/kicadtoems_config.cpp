@@ -17,6 +17,7 @@
  * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <fstream>
 #include <exception>
 #include <system_error>
@@ -36,6 +37,7 @@ Configuration::xyz_triplet<size_t> LoadTriplet_Int(Json::Value& ConfStruct);
 Configuration::xyz_triplet<double> LoadTriplet_Double(Json::Value& ConfStruct);
 Configuration::xyz_triplet<std::string> LoadTriplet_String(Json::Value& ConfStruct);
 Configuration::MaterialProps LoadMaterial(Json::Value& ConfStruct);
+Configuration::record_filter_t LoadFilter(Json::Value& ConfStruct);
 
 void TestKey(Json::Value& Element, const char* Key);
 double GetConf_asDouble(Json::Value& Element, const char* Key);
@@ -60,6 +62,18 @@ void Configuration::LoadConfig(const char* ConfigFile)
     conversion_settings.pcb_metal_thickness = GetConf_asDouble(conv_set, "pcb_metal_thickness");
     conversion_settings.pcb_metal_zero_thick = GetConf_asBool(conv_set, "pcb_metal_zero_thick");
     conversion_settings.corner_approximation = GetConf_asInt(conv_set, "corner_approximation");
+    // optional record filters
+    Json::Value filters = conv_set["filters"];
+    conversion_settings.layer_filter = LoadFilter(filters["layers"]);
+    conversion_settings.net_filter = LoadFilter(filters["nets"]);
+    // optional, off when missing
+    conversion_settings.merge_copper = conv_set["merge_copper"].asBool();
+    conversion_settings.cull_covered = conv_set["cull_covered"].asBool();
+    conversion_settings.native_cylinders = conv_set["native_cylinders"].asBool();
+    conversion_settings.native_boxes = conv_set["native_boxes"].asBool();
+    conversion_settings.zone_tolerance = conv_set["zone_tolerance"].asDouble();
+    Json::Value arc_tolerance = conv_set["arc_tolerance"];
+    conversion_settings.arc_tolerance = arc_tolerance.isString() ? 0 : arc_tolerance.asDouble();
     // configuration interactions
     if (conversion_settings.pcb_metal_zero_thick)
     {
@@ -98,6 +112,16 @@ void Configuration::LoadConfig(const char* ConfigFile)
         mesh_params.manual_mesh.Z.push_back(GetConf_asDouble(mesh_par["manual_mesh"]["Z"], i));
     }
 
+    // arc tolerance tied to mesh, arcs are not more exact than half of smallest cell
+    if (arc_tolerance.isString())
+    {
+        if (arc_tolerance.asString() != "min_cell_size")
+            throw load_conf_exc("arc_tolerance must be a number or \"min_cell_size\"");
+        conversion_settings.arc_tolerance = std::min(mesh_params.automatic_mesh.min_cell_size.X,
+                                                     mesh_params.automatic_mesh.min_cell_size.Y) /
+                                            2;
+    }
+
     Json::Value sim_box = conf["SimulationBox"];
     // =====================================================================================================================
     if (sim_box.isMember("min") && sim_box.isMember("max"))
@@ -144,6 +168,28 @@ Configuration::MaterialProps LoadMaterial(Json::Value& ConfStruct)
     return material;
 }
 
+Configuration::record_filter_t LoadFilter(Json::Value& ConfStruct)
+{
+    Configuration::record_filter_t filter;
+    const char* keys[2] = {"include", "exclude"};
+    std::vector<std::string>* lists[2] = {&filter.include, &filter.exclude};
+
+    for (size_t k = 0; k < 2; ++k)
+    {
+        Json::Value& list = ConfStruct[keys[k]];
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            // nets can be given by number
+            Json::Value& entry = list[(int)i];
+            if (entry.isIntegral())
+                lists[k]->push_back(std::to_string(entry.asInt()));
+            else
+                lists[k]->push_back(entry.asString());
+        }
+    }
+    return filter;
+}
+
 Configuration::xyz_triplet<size_t> LoadTriplet_Int(Json::Value& ConfStruct)
 {
     Configuration::xyz_triplet<size_t> triplet;
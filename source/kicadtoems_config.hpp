@@ -49,11 +49,25 @@ public:
         T Z;
     };
 
+    // record passes if it matches any include entry (or include is empty) and no exclude entry
+    struct record_filter_t {
+        std::vector<std::string> include;
+        std::vector<std::string> exclude;
+    };
+
     struct conversion_settings_t {
         double pcb_height;
         double pcb_metal_thickness;
         bool pcb_metal_zero_thick;
         size_t corner_approximation;
+        double arc_tolerance; // max chord error of arcs, 0 - corner_approximation is used
+        double zone_tolerance; // max deviation of simplified zone outlines, 0 - off
+        record_filter_t layer_filter; // copper layer names, "*.Cu" matches any copper layer
+        record_filter_t net_filter;   // net numbers or net names
+        bool merge_copper;            // union overlapping copper of same layer
+        bool cull_covered;            // drop traces and pads inside zones of same layer
+        bool native_cylinders;        // vias and round through hole pads as cylinders
+        bool native_boxes;            // axis aligned rectangles as boxes
     } conversion_settings;
 
     struct mesh_params_t {
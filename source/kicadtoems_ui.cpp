@@ -17,23 +17,74 @@
  * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <vector>
 #include <fstream>
-#include <iterator>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
 #include "kicadtoems_ui.hpp"
+#include "input_source.hpp"
 
 using namespace kicad_to_ems;
 
-std::vector<char> ReadFile(const char* filename);
-
-KiCAD_to_openEMS::KiCAD_to_openEMS(Configuration& Config, const char* KiCAD_PCB_File)
+class ui_exc : public std::runtime_error
+{
+public:
+    ui_exc(const std::string& Msg) : std::runtime_error(Msg) {}
+};
+
+KiCAD_to_openEMS::KiCAD_to_openEMS(Configuration& Config,
+                                   const char* KiCAD_PCB_File,
+                                   unsigned Jobs,
+                                   const char* CacheFile)
     : m_Config(Config)
 {
-    // load pcb file
-    std::vector<char> pcb_file = ReadFile(KiCAD_PCB_File);
+    // map pcb file, it is parsed in place
+    srecs::InputSource pcb_file(KiCAD_PCB_File);
 
     // generate models
-    m_Model = new ems::PCB_EMS_Model(pcb_file, m_Config);
+    m_Model = new ems::PCB_EMS_Model(m_Config);
+    if (CacheFile == nullptr)
+    {
+        m_Model->Convert(pcb_file, Jobs);
+        return;
+    }
+
+    uint64_t key = pems::CacheKey(pcb_file.Begin(), pcb_file.End(), m_Config);
+    if (m_Model->LoadCache(CacheFile, key))
+    {
+        std::cout << "Model primitives loaded from cache " << CacheFile << "\n";
+        return;
+    }
+    m_Model->Convert(pcb_file, Jobs);
+    m_Model->SaveCache(CacheFile, key);
+}
+
+KiCAD_to_openEMS::KiCAD_to_openEMS(Configuration& Config,
+                                   const char* KiCAD_PCB_File,
+                                   const char* ModelFile)
+    : m_Config(Config)
+{
+    // opened file is closed also if conversion throws, stdin is left open
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(nullptr, &std::fclose);
+    std::FILE* stream = stdin;
+    if (strcmp(KiCAD_PCB_File, "-") != 0)
+    {
+        file.reset(std::fopen(KiCAD_PCB_File, "rb"));
+        if (file == nullptr)
+            throw ui_exc(std::string("Can't open input file: ") + KiCAD_PCB_File);
+        stream = file.get();
+    }
+
+    // without model file output is discarded
+    std::ofstream ofile;
+    std::ostream null_stream(nullptr);
+    if (ModelFile != nullptr)
+        ofile.open(ModelFile, std::ios::out);
+
+    m_Model = new ems::PCB_EMS_Model(m_Config);
+    m_Model->ConvertStream(stream, ModelFile != nullptr ? ofile : null_stream);
 }
 KiCAD_to_openEMS::~KiCAD_to_openEMS() { delete m_Model; }
 
@@ -68,28 +119,3 @@ void KiCAD_to_openEMS::InjectModelData(const char* XML_Settings)
     std::string file_name(XML_Settings);
     m_Model->InjectOpenEMS_Script(file_name);
 }
-
-std::vector<char> ReadFile(const char* filename)
-{
-    // open the file:
-    std::ifstream file(filename, std::ios::in);
-
-    // Stop eating new lines in binary mode!!!
-    file.unsetf(std::ios::skipws);
-
-    // get its size:
-    std::streampos fileSize;
-
-    file.seekg(0, std::ios::end);
-    fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    // reserve capacity
-    std::vector<char> vec;
-    vec.reserve(fileSize);
-
-    // read the data:
-    vec.insert(vec.begin(), std::istream_iterator<char>(file), std::istream_iterator<char>());
-
-    return vec;
-}
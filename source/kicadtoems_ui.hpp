@@ -32,8 +32,16 @@ class KiCAD_to_openEMS
     ems::PCB_EMS_Model* m_Model;
 
 public:
-    // Perform PCB conversion
-    KiCAD_to_openEMS(Configuration& Config, const char* KiCAD_PCB_File);
+    // Perform PCB conversion using Jobs threads (0 - one per hardware thread)
+    // Primitives are reused from CacheFile if PCB file and configuration did not change,
+    // otherwise cache is regenerated
+    KiCAD_to_openEMS(Configuration& Config,
+                     const char* KiCAD_PCB_File,
+                     unsigned Jobs = 1,
+                     const char* CacheFile = nullptr);
+    // Perform PCB conversion in streaming mode. Model script is written to ModelFile
+    // (discarded if nullptr) while PCB file is read, only mesh data are kept.
+    KiCAD_to_openEMS(Configuration& Config, const char* KiCAD_PCB_File, const char* ModelFile);
     ~KiCAD_to_openEMS();
 
     // Save Octave script file with functions to generate model and mesh
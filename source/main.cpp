@@ -38,6 +38,10 @@ int main(int argc, char* argv[])
     bool grid_arg_set = false;
     bool model_arg_set = false;
     bool xml_arg_set = false;
+    bool stream_mode = false;
+    unsigned jobs = 1;
+    bool cache_arg_set = false;
+    std::string cache_file;
 
     std::string config_file;
     std::string grid_file;
@@ -64,17 +68,35 @@ int main(int argc, char* argv[])
         TCLAP::ValueArg<std::string> kicad_arg(
             "p", "pcb", "(IN) KiCAD PCB file to convert.",
             true, "pcb.kicad_pcb", "string");
+        TCLAP::SwitchArg stream_arg(
+            "s", "stream", "(optional) Streaming mode for very large PCB files. Model is written "
+            "while PCB file is read, XML injection is not available.");
+        TCLAP::ValueArg<unsigned> jobs_arg(
+            "j", "jobs", "(optional) Number of conversion threads, 0 - one per CPU thread. "
+            "Not used in streaming mode.",
+            false, 1, "number");
+        TCLAP::ValueArg<std::string> cache_arg(
+            "", "cache", "(optional) (IN/OUT) Binary cache of converted primitives. Reused when "
+            "PCB file and configuration did not change. Not used in streaming mode.",
+            false, "pcb.cache", "string");
 
         cmd.add(config_arg);
         cmd.add(grid_arg);
         cmd.add(model_arg);
         cmd.add(xml_arg);
         cmd.add(kicad_arg);
+        cmd.add(stream_arg);
+        cmd.add(jobs_arg);
+        cmd.add(cache_arg);
         cmd.parse(argc, argv);
 
         grid_arg_set = grid_arg.isSet();
         model_arg_set = model_arg.isSet();
         xml_arg_set = xml_arg.isSet();
+        stream_mode = stream_arg.getValue();
+        jobs = jobs_arg.getValue();
+        cache_arg_set = cache_arg.isSet();
+        cache_file = cache_arg.getValue();
 
         config_file = config_arg.getValue();
         grid_file = grid_arg.getValue();
@@ -92,8 +114,27 @@ int main(int argc, char* argv[])
     kicad_to_ems::Configuration conf;
     conf.LoadConfig(config_file.c_str());
 
+    if (stream_mode)
+    {
+        if (xml_arg_set)
+        {
+            std::cerr << "XML injection is not supported in streaming mode\n";
+            exit(-1);
+        }
+
+        // convert PCB, model is written during conversion
+        kicad_to_ems::KiCAD_to_openEMS converter(conf, pcb_file.c_str(),
+                                                 model_arg_set ? model_file.c_str() : nullptr);
+        if (grid_arg_set)
+        {
+            converter.WriteMesh_Octave(grid_file.c_str());
+        }
+        return g_ERROR;
+    }
+
     // convert PCB
-    kicad_to_ems::KiCAD_to_openEMS converter(conf, pcb_file.c_str());
+    kicad_to_ems::KiCAD_to_openEMS converter(conf, pcb_file.c_str(), jobs,
+                                             cache_arg_set ? cache_file.c_str() : nullptr);
 
     // write output files
     if (grid_arg_set)
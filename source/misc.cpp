@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "misc.hpp"
+
+using namespace kicad_to_ems::pems;
+using std::complex;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define MISC_X86_SIMD
+
+// x of two points in low and high lane, y of them
+static inline void load_xy(const complex<double>* P, __m128d& X, __m128d& Y)
+{
+    __m128d p0 = _mm_loadu_pd(reinterpret_cast<const double*>(P));
+    __m128d p1 = _mm_loadu_pd(reinterpret_cast<const double*>(P + 1));
+    X = _mm_unpacklo_pd(p0, p1);
+    Y = _mm_unpackhi_pd(p0, p1);
+}
+
+static inline __m128d orient_sse2(__m128d Ax, __m128d Ay, __m128d Bx, __m128d By, __m128d Cx,
+                                  __m128d Cy)
+{
+    return _mm_sub_pd(_mm_mul_pd(_mm_sub_pd(Bx, Ax), _mm_sub_pd(Cy, Ay)),
+                      _mm_mul_pd(_mm_sub_pd(By, Ay), _mm_sub_pd(Cx, Ax)));
+}
+
+// lanes where U and V are both positive or both negative
+static inline __m128d same_side(__m128d U, __m128d V)
+{
+    const __m128d zero = _mm_setzero_pd();
+    return _mm_or_pd(_mm_and_pd(_mm_cmpgt_pd(U, zero), _mm_cmpgt_pd(V, zero)),
+                     _mm_and_pd(_mm_cmplt_pd(U, zero), _mm_cmplt_pd(V, zero)));
+}
+
+// lanes where [A0, A1] and [B0, B1] ranges overlap
+static inline __m128d ranges_overlap(__m128d A0, __m128d A1, __m128d B0, __m128d B1)
+{
+    return _mm_and_pd(_mm_cmpge_pd(_mm_max_pd(A0, A1), _mm_min_pd(B0, B1)),
+                      _mm_cmpge_pd(_mm_max_pd(B0, B1), _mm_min_pd(A0, A1)));
+}
+#endif
+
+void Misc::lines_intersect(const complex<double>* L1_a,
+                           const complex<double>* L1_b,
+                           const complex<double>* L2_a,
+                           const complex<double>* L2_b,
+                           size_t Count,
+                           bool* Out)
+{
+    size_t i = 0;
+#ifdef MISC_X86_SIMD
+    const __m128d zero = _mm_setzero_pd();
+    for (; i + 2 <= Count; i += 2)
+    {
+        __m128d ax, ay, bx, by, cx, cy, dx, dy;
+        load_xy(L1_a + i, ax, ay);
+        load_xy(L1_b + i, bx, by);
+        load_xy(L2_a + i, cx, cy);
+        load_xy(L2_b + i, dx, dy);
+
+        __m128d d1 = orient_sse2(ax, ay, bx, by, cx, cy);
+        __m128d d2 = orient_sse2(ax, ay, bx, by, dx, dy);
+        __m128d d3 = orient_sse2(cx, cy, dx, dy, ax, ay);
+        __m128d d4 = orient_sse2(cx, cy, dx, dy, bx, by);
+
+        // same rules as scalar version: apart, or collinear with no overlap
+        __m128d collinear = _mm_and_pd(_mm_cmpeq_pd(d1, zero), _mm_cmpeq_pd(d2, zero));
+        __m128d overlap =
+            _mm_and_pd(ranges_overlap(ax, bx, cx, dx), ranges_overlap(ay, by, cy, dy));
+        __m128d miss = _mm_or_pd(_mm_or_pd(same_side(d1, d2), same_side(d3, d4)),
+                                 _mm_andnot_pd(overlap, collinear));
+        int mask = _mm_movemask_pd(miss);
+        Out[i] = (mask & 1) == 0;
+        Out[i + 1] = (mask & 2) == 0;
+    }
+#endif
+    for (; i < Count; ++i)
+        Out[i] = lines_intersect(L1_a[i], L1_b[i], L2_a[i], L2_b[i]);
+}
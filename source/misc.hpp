@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <complex>
+#include <cstddef>
 
 namespace kicad_to_ems
 {
@@ -31,63 +32,46 @@ namespace pems
 class Misc
 {
 public:
+    // > 0 - C is left of line AB, < 0 - right, 0 - on line
+    static double orient(std::complex<double> A, std::complex<double> B, std::complex<double> C)
+    {
+        return (B.real() - A.real()) * (C.imag() - A.imag()) -
+               (B.imag() - A.imag()) * (C.real() - A.real());
+    }
+
+    // segments cross or touch, collinear segments if they overlap
     static bool lines_intersect(std::complex<double> L1_a,
                                 std::complex<double> L1_b,
                                 std::complex<double> L2_a,
                                 std::complex<double> L2_b)
     {
-        std::complex<double> vect1, vect2;
-
-        vect1 = L1_b - L1_a;
-        vect2 = L2_b - L2_a;
-
-        // get line equations Y = N * X + C
-        double C1, C2, N1, N2;
-
-        N1 = tan(std::arg(vect1));
-        N2 = tan(std::arg(vect2));
-
-        C1 = L1_a.imag() - (N1 * L1_a.real());
-        C2 = L2_a.imag() - (N2 * L2_a.real());
-
-        // find intersection
-        double X_intersect = (C2 - C1) / (N1 - N2);
-        double Y_intersect = N1 * X_intersect + C1;
-
-        bool l1_hor = false;
-        bool l1_vert = false;
-        bool l2_hor = false;
-        bool l2_vert = false;
-
-        if (L1_a.real() == L1_b.real())
-            l1_vert = true;
-        if (L2_a.real() == L2_b.real())
-            l2_vert = true;
-        if (L1_a.imag() == L1_b.imag())
-            l1_hor = true;
-        if (L2_a.imag() == L2_b.imag())
-            l2_hor = true;
-
-        // check if in line range
-
-        bool l1_x_in_range = (l1_vert && fabs(X_intersect - L1_a.real()) < 1e-8) ||
-                             (X_intersect >= std::min(L1_a.real(), L1_b.real()) &&
-                              X_intersect <= std::max(L1_a.real(), L1_b.real()));
-
-        bool l2_x_in_range = (l2_vert && fabs(X_intersect - L2_a.real()) < 1e-8) ||
-                             (X_intersect >= std::min(L2_a.real(), L2_b.real()) &&
-                              X_intersect <= std::max(L2_a.real(), L2_b.real()));
-
-        bool l1_y_in_range = (l1_hor && fabs(Y_intersect - L1_a.imag()) < 1e-8) ||
-                             (Y_intersect >= std::min(L1_a.imag(), L1_b.imag()) &&
-                              Y_intersect <= std::max(L1_a.imag(), L1_b.imag()));
-
-        bool l2_y_in_range = (l2_hor && fabs(Y_intersect - L2_a.imag()) < 1e-8) ||
-                             (Y_intersect >= std::min(L2_a.imag(), L2_b.imag()) &&
-                              Y_intersect <= std::max(L2_a.imag(), L2_b.imag()));
-
-        return l1_x_in_range && l2_x_in_range && l1_y_in_range && l2_y_in_range;
+        // each segment has end points on both sides of (or on) the other one's line
+        double d1 = orient(L1_a, L1_b, L2_a);
+        double d2 = orient(L1_a, L1_b, L2_b);
+        if ((d1 > 0 && d2 > 0) || (d1 < 0 && d2 < 0))
+            return false;
+        double d3 = orient(L2_a, L2_b, L1_a);
+        double d4 = orient(L2_a, L2_b, L1_b);
+        if ((d3 > 0 && d4 > 0) || (d3 < 0 && d4 < 0))
+            return false;
+
+        // collinear, bounding boxes must overlap
+        if (d1 == 0 && d2 == 0)
+            return std::max(L1_a.real(), L1_b.real()) >= std::min(L2_a.real(), L2_b.real()) &&
+                   std::max(L2_a.real(), L2_b.real()) >= std::min(L1_a.real(), L1_b.real()) &&
+                   std::max(L1_a.imag(), L1_b.imag()) >= std::min(L2_a.imag(), L2_b.imag()) &&
+                   std::max(L2_a.imag(), L2_b.imag()) >= std::min(L1_a.imag(), L1_b.imag());
+        return true;
     }
+
+    // Out[i] = lines_intersect(L1_a[i], L1_b[i], L2_a[i], L2_b[i]) for Count segment
+    // pairs, two pairs at a time where SSE2 is available
+    static void lines_intersect(const std::complex<double>* L1_a,
+                                const std::complex<double>* L1_b,
+                                const std::complex<double>* L2_a,
+                                const std::complex<double>* L2_b,
+                                size_t Count,
+                                bool* Out);
 };
 
 } // namespace pems
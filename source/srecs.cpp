@@ -19,12 +19,10 @@
 
 #include "srecs.hpp"
 
+#include <algorithm>
 #include <cctype>
-#include <vector>
-#include <cstdint>
-#include <fstream>
-#include <iostream>
-#include <iterator>
+#include <cstring>
+#include <cstdlib>
 #include <exception>
 #include <system_error>
 
@@ -36,49 +34,358 @@ public:
     srec_exc(const char* Msg) : std::runtime_error(Msg) {}
 };
 
-void SREC::SetPosition(charvec_t::iterator& Position) { m_Current = Position; }
+static const char* s_KnownSymbols[SYM_KNOWN_COUNT] = {
+    "kicad_pcb", "version", "host",  "setup", "aux_axis_origin", "segment",   "via",
+    "zone",      "module",  "pad",   "gr_line", "gr_arc",        "gr_circle", "gr_rect",
+    "at",        "start",   "end",   "center",  "angle",         "width",     "size",
+    "drill",     "layer",   "layers", "min_thickness", "filled_polygon", "pts", "xy",
+    "net"};
+
+static charptr_t name_end(charptr_t It, charptr_t End);
+
+/*
+    Structural character scanner. Each call classifies 64 bytes and returns bitmask
+    of '(', ')', '"' and '\\' positions, bit 0 is first byte. Vector version is
+    picked at runtime, scalar one is used on other architectures.
+*/
+typedef uint64_t (*block_scanner_t)(charptr_t Block);
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define SRECS_X86_SIMD
+
+static uint64_t scan_block_sse2(charptr_t Block)
+{
+    const __m128i paren = _mm_set1_epi8(')');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i one = _mm_set1_epi8(1);
+    uint64_t mask = 0;
+    for (int k = 0; k < 4; ++k)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(Block + 16 * k));
+        // '(' is 0x28 and ')' is 0x29
+        __m128i m = _mm_cmpeq_epi8(_mm_or_si128(v, one), paren);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, backslash));
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(m) << (16 * k);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t scan_block_avx2(charptr_t Block)
+{
+    const __m256i paren = _mm256_set1_epi8(')');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i one = _mm256_set1_epi8(1);
+    uint64_t mask = 0;
+    for (int k = 0; k < 2; ++k)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(Block + 32 * k));
+        __m256i m = _mm256_cmpeq_epi8(_mm256_or_si256(v, one), paren);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quote));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, backslash));
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(m) << (32 * k);
+    }
+    return mask;
+}
+#else
+static uint64_t scan_block_scalar(charptr_t Block)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; ++i)
+    {
+        char c = Block[i];
+        if (c == '(' || c == ')' || c == '"' || c == '\\')
+            mask |= (uint64_t)1 << i;
+    }
+    return mask;
+}
+#endif
+
+static block_scanner_t select_block_scanner()
+{
+#ifdef SRECS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_block_avx2;
+    return scan_block_sse2;
+#else
+    return scan_block_scalar;
+#endif
+}
+
+// mask of structural characters in [It, min(It + 64, End))
+static uint64_t structural_mask(charptr_t It, charptr_t End)
+{
+    static const block_scanner_t scan_block = select_block_scanner();
+    if (End - It >= 64)
+        return scan_block(It);
+
+    // zero padding is not structural
+    char block[64] = {0};
+    memcpy(block, It, End - It);
+    return scan_block(block);
+}
+
+static inline unsigned lowest_bit(uint64_t Mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(Mask);
+#else
+    unsigned bit = 0;
+    while ((Mask & 1) == 0)
+    {
+        Mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static uint32_t name_hash(charptr_t Name, size_t Length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < Length; ++i)
+    {
+        hash ^= (unsigned char)Name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+SymbolTable::SymbolTable() : m_Slots(64, entry{nullptr, 0, NO_SYMBOL}), m_Count(0)
+{
+    for (size_t i = 0; i < SYM_KNOWN_COUNT; ++i)
+    {
+        Intern(s_KnownSymbols[i], strlen(s_KnownSymbols[i]));
+    }
+}
+
+uint32_t SymbolTable::Lookup(charptr_t Name, size_t Length, uint32_t Hash) const
+{
+    uint32_t mask = m_Slots.size() - 1;
+    uint32_t slot = Hash & mask;
+    while (m_Slots[slot].id != NO_SYMBOL)
+    {
+        const entry& e = m_Slots[slot];
+        if (e.length == Length && memcmp(e.name, Name, Length) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+uint32_t SymbolTable::Intern(charptr_t Name, size_t Length)
+{
+    uint32_t slot = Lookup(Name, Length, name_hash(Name, Length));
+    if (m_Slots[slot].id != NO_SYMBOL)
+        return m_Slots[slot].id;
+
+    m_Slots[slot] = entry{Name, (uint32_t)Length, m_Count};
+    m_Count++;
+    // keep load factor below 1/2
+    if (m_Count * 2 > m_Slots.size())
+        Grow();
+    return m_Count - 1;
+}
+
+uint32_t SymbolTable::Find(const char* Name) const
+{
+    size_t length = strlen(Name);
+    return m_Slots[Lookup(Name, length, name_hash(Name, length))].id;
+}
+
+void SymbolTable::Grow()
+{
+    std::vector<entry> old(m_Slots.size() * 2, entry{nullptr, 0, NO_SYMBOL});
+    old.swap(m_Slots);
+    for (size_t i = 0; i < old.size(); ++i)
+    {
+        if (old[i].id != NO_SYMBOL)
+            m_Slots[Lookup(old[i].name, old[i].length, name_hash(old[i].name, old[i].length))] =
+                old[i];
+    }
+}
+
+Tape::Tape(charptr_t Begin, charptr_t End) : m_Begin(Begin), m_End(End)
+{
+    if ((size_t)(End - Begin) >= NO_NODE)
+        throw srec_exc("Input data too large for record tape");
+    Tokenize();
+    LinkSameSymbols();
+}
+
+void Tape::Tokenize()
+{
+    struct open_rec {
+        uint32_t node;
+        uint32_t last_child;
+    };
+    std::vector<open_rec> open;
+    uint32_t last_top = NO_NODE;
+
+    uint32_t size = m_End - m_Begin;
+    m_Nodes.reserve(size / 24);
+
+    // only structural characters are visited, backslash escapes next character
+    bool quoted = false;
+    uint32_t escaped = NO_NODE;
+    for (uint32_t block = 0; block < size; block += 64)
+    {
+        uint64_t mask = structural_mask(m_Begin + block, m_End);
+        while (mask != 0)
+        {
+            uint32_t i = block + lowest_bit(mask);
+            mask &= mask - 1;
+
+            char c = m_Begin[i];
+            if (c == '\\')
+            {
+                escaped = i + 1;
+                continue;
+            }
+            if (i == escaped)
+                continue;
+            if (c == '"')
+            {
+                quoted = !quoted;
+                continue;
+            }
+            if (quoted)
+                continue;
+
+            if (c == '(')
+            {
+                uint32_t index = m_Nodes.size();
+                charptr_t name = m_Begin + i + 1;
+                uint32_t symbol = m_Symbols.Intern(name, name_end(name, m_End) - name);
+                Node node = {i, size, NO_NODE, NO_NODE, NO_NODE, symbol, NO_NODE};
+                if (open.empty())
+                {
+                    if (last_top != NO_NODE)
+                        m_Nodes[last_top].NextSibling = index;
+                    last_top = index;
+                }
+                else
+                {
+                    open_rec& parent = open.back();
+                    node.Parent = parent.node;
+                    if (parent.last_child != NO_NODE)
+                        m_Nodes[parent.last_child].NextSibling = index;
+                    else
+                        m_Nodes[parent.node].FirstChild = index;
+                    parent.last_child = index;
+                }
+                m_Nodes.push_back(node);
+                open.push_back({index, NO_NODE});
+            }
+            else if (!open.empty())
+            {
+                // ')'
+                m_Nodes[open.back().node].End = i;
+                open.pop_back();
+            }
+        }
+    }
+}
+
+void Tape::LinkSameSymbols()
+{
+    if (m_Nodes.empty())
+        return;
+
+    // last record seen with each name in current list
+    std::vector<uint32_t> last(m_Symbols.Size(), NO_NODE);
+    std::vector<uint32_t> used;
+
+    // top level list starts at first node, other lists at first child of each record
+    for (uint32_t i = 0; i <= m_Nodes.size(); ++i)
+    {
+        uint32_t index = i == 0 ? 0 : m_Nodes[i - 1].FirstChild;
+        for (; index != NO_NODE; index = m_Nodes[index].NextSibling)
+        {
+            uint32_t symbol = m_Nodes[index].Symbol;
+            if (last[symbol] != NO_NODE)
+                m_Nodes[last[symbol]].NextSame = index;
+            else
+                used.push_back(symbol);
+            last[symbol] = index;
+        }
+
+        for (size_t k = 0; k < used.size(); ++k)
+            last[used[k]] = NO_NODE;
+        used.clear();
+    }
+}
+
+void SREC::SetPosition(uint32_t Position)
+{
+    m_Node = Position;
+    m_FirstCall = false;
+}
 
 std::string SREC::GetRecord()
 {
-    charvec_t::iterator rec_start = GetPosition();
-    FindRecEnd();
-    charvec_t::iterator rec_end = GetPosition();
-    if (rec_end != m_End)
-        rec_end++;
-    SetPosition(rec_start);
-    std::string record(rec_start, rec_end);
-    return record;
+    charptr_t rec_start, rec_end;
+    GetRecord(rec_start, rec_end);
+    return std::string(rec_start, rec_end);
+}
+
+void SREC::GetRecord(charptr_t& Begin, charptr_t& End)
+{
+    if (m_Node == NO_NODE)
+        throw srec_exc("Record read error");
+    const Node& node = m_Tape->GetNode(m_Node);
+    Begin = m_Tape->Data() + node.Begin;
+    End = m_Tape->Data() + node.End;
+    if (End != m_Tape->DataEnd())
+        End++;
 }
 
 bool SREC::GetNext()
 {
-    if (m_Current == m_Begin && m_FirstCall)
+    if (m_FirstCall)
     {
         m_FirstCall = false;
-        if (!FindRecStart())
-            return false;
-    }
-    else
-    {
-        FindRecEnd();
-        if (!FindRecStart())
+        if (m_Tape->Size() == 0)
             return false;
+        m_Node = 0;
+        return true;
     }
 
-    if (IsEnd())
-    {
+    if (m_Node == NO_NODE)
         return false;
-    }
+    uint32_t next = m_Tape->GetNode(m_Node).NextSibling;
+    if (next == NO_NODE)
+        return false;
+    m_Node = next;
     return true;
 }
 
-bool SREC::GetNext(const char* Name)
+bool SREC::GetNext(const char* Name) { return GetNext(m_Tape->GetSymbols().Find(Name)); }
+
+bool SREC::GetNext(uint32_t Symbol)
 {
-    charvec_t::iterator pos = GetPosition();
+    if (Symbol == NO_SYMBOL)
+        return false;
+
+    // records with same name are linked, no need to visit records in between
+    if (!m_FirstCall && m_Node != NO_NODE && m_Tape->GetNode(m_Node).Symbol == Symbol)
+    {
+        uint32_t next = m_Tape->GetNode(m_Node).NextSame;
+        if (next == NO_NODE)
+            return false;
+        m_Node = next;
+        return true;
+    }
+
+    uint32_t pos = GetPosition();
     while (GetNext())
     {
-        std::string rec_name = GetRecName();
-        if (rec_name.compare(Name) == 0)
+        if (m_Tape->GetNode(m_Node).Symbol == Symbol)
         {
             return true;
         }
@@ -88,19 +395,32 @@ bool SREC::GetNext(const char* Name)
     return false;
 }
 
-bool SREC::GetChild() { return FindChildRec(); }
+bool SREC::GetChild()
+{
+    if (m_Node == NO_NODE)
+        return false;
+    uint32_t child = m_Tape->GetNode(m_Node).FirstChild;
+    if (child == NO_NODE)
+        return false;
+    m_Node = child;
+    return true;
+}
+
+bool SREC::GetChild(const char* Name) { return GetChild(m_Tape->GetSymbols().Find(Name)); }
 
-bool SREC::GetChild(const char* Name)
+bool SREC::GetChild(uint32_t Symbol)
 {
-    charvec_t::iterator pos = GetPosition();
+    if (Symbol == NO_SYMBOL)
+        return false;
+
+    uint32_t pos = GetPosition();
     if (GetChild())
     {
-        std::string name = GetRecName();
-        if (name.compare(Name) == 0)
+        if (m_Tape->GetNode(m_Node).Symbol == Symbol)
         {
             return true;
         }
-        if (GetNext(Name))
+        if (GetNext(Symbol))
         {
             return true;
         }
@@ -112,149 +432,416 @@ bool SREC::GetChild(const char* Name)
 
 std::string SREC::GetRecName()
 {
-    charvec_t::iterator cur_pos = GetPosition();
-    EnterRecord();
-    if (IsEnd())
+    if (m_Node == NO_NODE)
         throw srec_exc("Record name read error");
-    std::string str = GetCurString();
-    SetPosition(cur_pos);
-    return str;
+    charptr_t name = m_Tape->Data() + m_Tape->GetNode(m_Node).Begin + 1;
+    if (name >= m_Tape->DataEnd())
+        throw srec_exc("Record name read error");
+    return std::string(name, NameEnd());
 }
 
-bool SREC::IsEnd()
+uint32_t SREC::GetRecSymbol()
 {
-    if (m_Current == m_End)
+    if (m_Node == NO_NODE)
+        throw srec_exc("Record name read error");
+    return m_Tape->GetNode(m_Node).Symbol;
+}
+
+bool SREC::GetAtom(size_t Index, charptr_t& Begin, charptr_t& End)
+{
+    if (m_Node == NO_NODE)
+        return false;
+    uint32_t child = m_Tape->GetNode(m_Node).FirstChild;
+    charptr_t it = NameEnd();
+    for (size_t i = 0;; ++i)
     {
-        return true;
+        it = NextAtom(it, child, End);
+        if (it == nullptr)
+            return false;
+        if (i == Index)
+        {
+            Begin = it;
+            return true;
+        }
+        it = End;
     }
-    return false;
 }
 
-charvec_t::iterator SREC::GetPosition() { return m_Current; }
+size_t SREC::GetAtomCount()
+{
+    if (m_Node == NO_NODE)
+        return 0;
+    uint32_t child = m_Tape->GetNode(m_Node).FirstChild;
+    charptr_t it = NameEnd();
+    charptr_t atom_end;
+    size_t count = 0;
+    while ((it = NextAtom(it, child, atom_end)) != nullptr)
+    {
+        count++;
+        it = atom_end;
+    }
+    return count;
+}
+
+static bool unquoted_equals(charptr_t Begin, charptr_t End, const char* Value)
+{
+    if (End - Begin >= 2 && *Begin == '"' && *(End - 1) == '"')
+    {
+        Begin++;
+        End--;
+    }
+    size_t len = End - Begin;
+    return strlen(Value) == len && memcmp(Begin, Value, len) == 0;
+}
+
+bool SREC::AtomEquals(size_t Index, const char* Value)
+{
+    charptr_t begin, end;
+    if (!GetAtom(Index, begin, end))
+        return false;
+    return unquoted_equals(begin, end, Value);
+}
+
+bool SREC::HasAtom(const char* Value)
+{
+    if (m_Node == NO_NODE)
+        return false;
+    uint32_t child = m_Tape->GetNode(m_Node).FirstChild;
+    charptr_t it = NameEnd();
+    charptr_t atom_end;
+    while ((it = NextAtom(it, child, atom_end)) != nullptr)
+    {
+        if (unquoted_equals(it, atom_end, Value))
+            return true;
+        it = atom_end;
+    }
+    return false;
+}
 
-bool SREC::FindRecStart()
+size_t SREC::GetDoubles(double* Values, size_t Count, size_t FirstAtom)
 {
-    bool first = true;
-    while (m_Current != m_End)
+    if (m_Node == NO_NODE)
+        return 0;
+    uint32_t child = m_Tape->GetNode(m_Node).FirstChild;
+    charptr_t it = NameEnd();
+    charptr_t atom_end;
+    size_t index = 0;
+    size_t read = 0;
+    while (read < Count && (it = NextAtom(it, child, atom_end)) != nullptr)
     {
-        if (m_Current != m_Begin || !first)
+        if (index >= FirstAtom)
         {
-            m_Current++;
+            if (!ParseDouble(it, atom_end, Values[read]))
+                break;
+            read++;
         }
-        char c = *m_Current;
+        index++;
+        it = atom_end;
+    }
+    return read;
+}
+
+charptr_t SREC::NextAtom(charptr_t It, uint32_t& Child, charptr_t& AtomEnd)
+{
+    charptr_t data = m_Tape->Data();
+    const Node& node = m_Tape->GetNode(m_Node);
+    charptr_t end = data + node.End;
+
+    while (It < end)
+    {
+        char c = *It;
         if (c == '(')
         {
-            return true;
+            // jump over child record
+            if (Child == NO_NODE)
+                return nullptr;
+            const Node& child = m_Tape->GetNode(Child);
+            It = data + child.End + 1;
+            Child = child.NextSibling;
+            continue;
         }
-        if (c == ')')
+        if (c == ' ' || iscntrl((unsigned char)c))
         {
-            break;
+            It++;
+            continue;
         }
-        first = false;
+        break;
     }
-    return false;
-}
-
-bool SREC::FindChildRec()
-{
-    charvec_t::iterator it = m_Current;
+    if (It >= end)
+        return nullptr;
 
-    bool quoted = false;
-    size_t skip_n = 0;
-    while (m_Current != m_End)
+    charptr_t it = It;
+    if (*it == '"')
     {
-        m_Current++;
-        char c = *m_Current;
-        if (c == '\\')
+        it++;
+        while (it < end && *it != '"')
         {
-            skip_n = 2;
+            if (*it == '\\')
+                it++;
+            it++;
         }
-        if (skip_n == 0)
+        if (it < end)
+            it++;
+    }
+    else
+    {
+        while (it < end)
         {
-            if (c == '"')
-            {
-                quoted = !quoted;
-            }
-            if (!quoted)
-            {
-                if (c == '(')
-                {
-                    return true;
-                }
-                if (c == ')')
-                {
-                    m_Current = it;
-                    break;
-                }
-            }
+            char c = *it;
+            if (c == ')' || c == ' ' || iscntrl((unsigned char)c) || c == '(')
+                break;
+            it++;
         }
-        if (skip_n > 0)
-            skip_n--;
     }
-    return false;
+    AtomEnd = it < end ? it : end;
+    return It;
 }
 
-void SREC::FindRecEnd()
+bool SREC::IsEnd() { return m_Node == NO_NODE; }
+
+uint32_t SREC::GetPosition() { return m_Node; }
+
+charptr_t SREC::NameEnd()
 {
-    size_t depth = 1;
-    bool quoted = false;
-    size_t skip_n = 0;
-    while (m_Current != m_End)
+    return name_end(m_Tape->Data() + m_Tape->GetNode(m_Node).Begin + 1, m_Tape->DataEnd());
+}
+
+static charptr_t name_end(charptr_t It, charptr_t End)
+{
+    while (It < End)
     {
-        m_Current++;
-        char c = *m_Current;
-        if (c == '\\')
+        char c = *It;
+        if (c == ')' || c == ' ' || iscntrl((unsigned char)c) || c == '(') // or control chars
         {
-            skip_n = 2;
+            break;
         }
-        if (skip_n == 0)
+        It++;
+    }
+    return It;
+}
+
+RecordReader::RecordReader(std::FILE* Stream, size_t ChunkSize)
+    : m_Stream(Stream), m_ChunkSize(ChunkSize), m_Used(0), m_Pos(0), m_RecStart(0),
+      m_RootStart(std::string::npos), m_Depth(0), m_Quoted(false),
+      m_EscapedPos(std::string::npos), m_Eof(false)
+{
+}
+
+bool RecordReader::Fill()
+{
+    if (m_Eof)
+        return false;
+
+    // drop everything before the record being read
+    size_t keep_from = m_Depth >= 2 ? m_RecStart : m_Pos;
+    if (m_RootName.empty() && m_RootStart != std::string::npos)
+        keep_from = m_RootStart;
+    if (keep_from > 0)
+    {
+        memmove(m_Buffer.data(), m_Buffer.data() + keep_from, m_Used - keep_from);
+        m_Used -= keep_from;
+        m_Pos -= keep_from;
+        m_RecStart -= std::min(m_RecStart, keep_from);
+        if (m_EscapedPos != std::string::npos)
+            m_EscapedPos = m_EscapedPos >= keep_from ? m_EscapedPos - keep_from
+                                                     : std::string::npos;
+        if (m_RootStart != std::string::npos)
+            m_RootStart -= std::min(m_RootStart, keep_from);
+    }
+
+    if (m_Buffer.size() < m_Used + m_ChunkSize)
+        m_Buffer.resize(m_Used + m_ChunkSize);
+    size_t n = std::fread(m_Buffer.data() + m_Used, 1, m_ChunkSize, m_Stream);
+    if (n < m_ChunkSize)
+    {
+        if (std::ferror(m_Stream))
+            throw srec_exc("Input stream read failed");
+        m_Eof = true;
+    }
+    m_Used += n;
+    return n > 0;
+}
+
+bool RecordReader::Next(charptr_t& Begin, charptr_t& End)
+{
+    // same quote and escape rules as Tape::Tokenize()
+    while (true)
+    {
+        if (m_Pos == m_Used && !Fill())
+            return false;
+
+        charptr_t data = m_Buffer.data();
+        uint64_t mask = structural_mask(data + m_Pos, data + m_Used);
+        size_t block = m_Pos;
+        m_Pos = std::min(m_Pos + 64, m_Used);
+
+        while (mask != 0)
         {
+            size_t pos = block + lowest_bit(mask);
+            mask &= mask - 1;
+
+            char c = data[pos];
+            if (c == '\\')
+            {
+                m_EscapedPos = pos + 1;
+                continue;
+            }
+            if (pos == m_EscapedPos)
+                continue;
             if (c == '"')
             {
-                quoted = !quoted;
+                m_Quoted = !m_Quoted;
+                continue;
             }
-            if (!quoted)
+            if (m_Quoted)
+                continue;
+
+            if (c == '(')
             {
-                if (c == '(')
+                m_Depth++;
+                if (m_Depth == 1)
                 {
-                    depth++;
+                    m_RootStart = pos;
                 }
-                if (c == ')')
+                else if (m_Depth == 2)
                 {
-                    if (depth > 0)
-                        depth--;
-                    if (depth == 0)
+                    if (m_RootName.empty())
                     {
-                        break;
+                        charptr_t name = data + m_RootStart + 1;
+                        m_RootName.assign(name, name_end(name, data + pos));
                     }
+                    m_RecStart = pos;
+                }
+            }
+            else if (m_Depth > 0)
+            {
+                // ')'
+                m_Depth--;
+                if (m_Depth == 0)
+                {
+                    // end of root list
+                    m_Pos = pos + 1;
+                    m_Eof = true;
+                    m_Used = m_Pos;
+                    return false;
+                }
+                if (m_Depth == 1)
+                {
+                    m_Pos = pos + 1;
+                    Begin = data + m_RecStart;
+                    End = data + m_Pos;
+                    return true;
                 }
             }
         }
-        if (skip_n > 0)
-            skip_n--;
     }
 }
 
-void SREC::EnterRecord()
+/**
+    @brief Parse decimal number from [Begin, End), whole range must be a number
+
+    Numbers with up to 15 significant digits and small exponents (all numbers in
+    kicad_pcb files) are converted exactly with a single multiplication or division,
+    everything else is handed to strtod.
+*/
+bool kicad_to_ems::srecs::ParseDouble(charptr_t Begin, charptr_t End, double& Value)
 {
-    if (m_Current != m_End)
+    static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                   1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    charptr_t it = Begin;
+    bool negative = false;
+    if (it < End && (*it == '-' || *it == '+'))
     {
-        m_Current++;
+        negative = *it == '-';
+        it++;
     }
-}
 
-std::string SREC::GetCurString()
-{
-    std::string str;
-    while (m_Current != m_End)
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+    bool exact = true;
+
+    while (it < End && *it >= '0' && *it <= '9')
     {
-        char c = *m_Current;
-        if (c == ')' || c == ' ' || iscntrl(c) || c == '(') // or control chars
+        any_digit = true;
+        if (digits < 19)
         {
-            break;
+            mantissa = mantissa * 10 + (*it - '0');
+            if (mantissa != 0)
+                digits++;
+        }
+        else
+        {
+            exponent++;
+            exact = false;
+        }
+        it++;
+    }
+    if (it < End && *it == '.')
+    {
+        it++;
+        while (it < End && *it >= '0' && *it <= '9')
+        {
+            any_digit = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*it - '0');
+                if (mantissa != 0)
+                    digits++;
+                exponent--;
+            }
+            else
+            {
+                exact = false;
+            }
+            it++;
+        }
+    }
+    if (any_digit && it < End && (*it == 'e' || *it == 'E'))
+    {
+        it++;
+        bool exp_negative = false;
+        if (it < End && (*it == '-' || *it == '+'))
+        {
+            exp_negative = *it == '-';
+            it++;
+        }
+        int exp = 0;
+        bool exp_digit = false;
+        while (it < End && *it >= '0' && *it <= '9')
+        {
+            exp_digit = true;
+            if (exp < 10000)
+                exp = exp * 10 + (*it - '0');
+            it++;
         }
-        str.push_back(c);
-        m_Current++;
+        if (!exp_digit)
+            return false;
+        exponent += exp_negative ? -exp : exp;
+    }
+
+    if (any_digit && it == End && exact && digits <= 15 && exponent >= -22 && exponent <= 22)
+    {
+        double value = (double)mantissa;
+        if (exponent < 0)
+            value /= pow10[-exponent];
+        else
+            value *= pow10[exponent];
+        Value = negative ? -value : value;
+        return true;
     }
-    return str;
+
+    // slow path: long mantissa, large exponent, inf, nan
+    size_t len = End - Begin;
+    if (len == 0 || len > 63)
+        return false;
+    char buffer[64];
+    memcpy(buffer, Begin, len);
+    buffer[len] = 0;
+    char* parse_end;
+    Value = strtod(buffer, &parse_end);
+    return parse_end == buffer + len;
 }
@@ -20,48 +20,203 @@
 #ifndef srecs_h
 #define srecs_h
 
-#include <vector>
 #include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
 
 namespace kicad_to_ems
 {
 namespace srecs
 {
 
-typedef std::vector<char> charvec_t;
+typedef const char* charptr_t;
+
+static const uint32_t NO_NODE = 0xFFFFFFFF;
+static const uint32_t NO_SYMBOL = 0xFFFFFFFF;
+
+// Record names used by the converter. They are interned first, so their ids are
+// known at compile time. Any other record name gets next free id when tokenized.
+enum Symbol : uint32_t {
+    SYM_KICAD_PCB = 0,
+    SYM_VERSION,
+    SYM_HOST,
+    SYM_SETUP,
+    SYM_AUX_AXIS_ORIGIN,
+    SYM_SEGMENT,
+    SYM_VIA,
+    SYM_ZONE,
+    SYM_MODULE,
+    SYM_PAD,
+    SYM_GR_LINE,
+    SYM_GR_ARC,
+    SYM_GR_CIRCLE,
+    SYM_GR_RECT,
+    SYM_AT,
+    SYM_START,
+    SYM_END,
+    SYM_CENTER,
+    SYM_ANGLE,
+    SYM_WIDTH,
+    SYM_SIZE,
+    SYM_DRILL,
+    SYM_LAYER,
+    SYM_LAYERS,
+    SYM_MIN_THICKNESS,
+    SYM_FILLED_POLYGON,
+    SYM_PTS,
+    SYM_XY,
+    SYM_NET,
+    SYM_KNOWN_COUNT
+};
+
+/**
+    @brief Interns record names to integer ids
+
+    Open addressing hash table keyed by name text, names are not copied so they
+    must outlive the table.
+*/
+class SymbolTable
+{
+public:
+    SymbolTable();
+
+    uint32_t Intern(charptr_t Name, size_t Length);
+    uint32_t Find(const char* Name) const;
+    size_t Size() const { return m_Count; }
+
+private:
+    struct entry {
+        charptr_t name;
+        uint32_t length;
+        uint32_t id;
+    };
+    std::vector<entry> m_Slots;
+    uint32_t m_Count;
+
+    uint32_t Lookup(charptr_t Name, size_t Length, uint32_t Hash) const;
+    void Grow();
+};
+
+/**
+    @brief One S-expression list, stored by offsets into the source data
+*/
+struct Node {
+    uint32_t Begin;       // offset of '('
+    uint32_t End;         // offset of matching ')', data size if unterminated
+    uint32_t Parent;      // NO_NODE for top level records
+    uint32_t FirstChild;  // NO_NODE if record has no child records
+    uint32_t NextSibling; // NO_NODE for last record in list
+    uint32_t Symbol;      // interned record name
+    uint32_t NextSame;    // next record in list with same name, NO_NODE if none
+};
+
+/**
+    @brief Flat node array (tape) of all records in the data
+
+    Data is tokenized once, records are then navigated by node offsets without
+    rescanning the text. Data must outlive the tape.
+*/
+class Tape
+{
+public:
+    Tape(charptr_t Begin, charptr_t End);
+
+    const Node& GetNode(uint32_t Index) const { return m_Nodes[Index]; }
+    size_t Size() const { return m_Nodes.size(); }
+    charptr_t Data() const { return m_Begin; }
+    charptr_t DataEnd() const { return m_End; }
+    const SymbolTable& GetSymbols() const { return m_Symbols; }
+
+private:
+    charptr_t m_Begin;
+    charptr_t m_End;
+    std::vector<Node> m_Nodes;
+    SymbolTable m_Symbols;
 
+    void Tokenize();
+    void LinkSameSymbols();
+};
+
+/**
+    @brief Cursor over records of a tape
+*/
 class SREC
 {
 public:
-    SREC(charvec_t::iterator Begin, charvec_t::iterator End)
-        : m_Begin(Begin), m_Current(Begin), m_End(End), m_FirstCall(true)
-    {}
+    SREC(const Tape& Data) : m_Tape(&Data), m_Node(NO_NODE), m_FirstCall(true) {}
 
-    void SetPosition(charvec_t::iterator& Position);
+    void SetPosition(uint32_t Position);
 
     bool GetNext();
     bool GetNext(const char* Name);
+    bool GetNext(uint32_t Symbol);
     bool GetChild();
     bool GetChild(const char* Name);
+    bool GetChild(uint32_t Symbol);
 
     std::string GetRecord();
+    // whole record text including parens, without copying
+    void GetRecord(charptr_t& Begin, charptr_t& End);
     std::string GetRecName();
-    charvec_t::iterator GetPosition();
+    uint32_t GetRecSymbol();
+
+    // Atoms are values between record name and closing paren, child records excluded.
+    // Quoted atoms are returned with quotes, comparisons use unquoted text.
+    bool GetAtom(size_t Index, charptr_t& Begin, charptr_t& End);
+    size_t GetAtomCount();
+    bool AtomEquals(size_t Index, const char* Value);
+    bool HasAtom(const char* Value);
+    // Parse up to Count numeric atoms starting at FirstAtom, returns number of values read
+    size_t GetDoubles(double* Values, size_t Count, size_t FirstAtom = 0);
+    uint32_t GetPosition();
     bool IsEnd();
 
 private:
-    charvec_t::iterator m_Begin;
-    charvec_t::iterator m_Current;
-    charvec_t::iterator m_End;
+    const Tape* m_Tape;
+    uint32_t m_Node;
     bool m_FirstCall;
 
-    bool FindRecStart();
-    void FindRecEnd();
-    bool FindChildRec();
-    void EnterRecord();
-    std::string GetCurString();
+    charptr_t NameEnd();
+    charptr_t NextAtom(charptr_t It, uint32_t& Child, charptr_t& AtomEnd);
+};
+
+/**
+    @brief Reads records nested in the root list of a stream one by one
+
+    Stream is read in fixed size chunks, buffer holds only the record being read, so
+    memory use is bounded by the largest record and not by the stream size.
+*/
+class RecordReader
+{
+public:
+    RecordReader(std::FILE* Stream, size_t ChunkSize = 1 << 16);
+
+    // Returned range is valid until next call, false at end of the root list
+    bool Next(charptr_t& Begin, charptr_t& End);
+    // Name of the root list, known after first Next() call
+    const std::string& GetRootName() const { return m_RootName; }
+
+private:
+    std::FILE* m_Stream;
+    size_t m_ChunkSize;
+    std::vector<char> m_Buffer;
+    size_t m_Used;
+    size_t m_Pos;
+    size_t m_RecStart;
+    size_t m_RootStart;
+    std::string m_RootName;
+    uint32_t m_Depth;
+    bool m_Quoted;
+    // character at this position follows backslash and is escaped
+    size_t m_EscapedPos;
+    bool m_Eof;
+
+    bool Fill();
 };
 
+bool ParseDouble(charptr_t Begin, charptr_t End, double& Value);
+
 } // namespace srecs
 } // namespace kicad_to_ems
 
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Offset of large circles with coordinates rounded to whole nanometers, as KiCad stores
+// them, must resolve to one outline at the offset distance.
+
+#include "ems_union.hpp"
+
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <vector>
+
+using namespace kicad_to_ems::pems;
+
+static bool offset_circle(size_t Count, double Radius, double Distance)
+{
+    std::vector<std::complex<double>> points;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        double angle = 2 * M_PI * i / Count;
+        points.emplace_back(std::round(Radius * std::cos(angle) * 1e6) / 1e6,
+                            std::round(Radius * std::sin(angle) * 1e6) / 1e6);
+    }
+
+    std::vector<std::complex<double>> outline;
+    PolygonOffset offset(PolygonOffset::JOIN_ROUND, 4);
+    if (!offset.Run(points.data(), points.size(), Distance, outline))
+    {
+        printf("circle %zu r=%g d=%g: offset failed\n", Count, Radius, Distance);
+        return false;
+    }
+
+    for (const auto& point : outline)
+    {
+        if (std::fabs(std::abs(point) - (Radius + Distance)) > 2e-6)
+        {
+            printf("circle %zu r=%g d=%g: point at radius %.9f\n", Count, Radius, Distance,
+                   std::abs(point));
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= offset_circle(50000, 1, 0.05);
+    ok &= offset_circle(100000, 1, 0.05);
+    ok &= offset_circle(100000, 20, 0.125);
+    ok &= offset_circle(100000, 50, 0.25);
+    return ok ? 0 : 1;
+}
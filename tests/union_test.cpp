@@ -0,0 +1,83 @@
+/*
+ * Copyright 2017 Jānis Skujenieks
+ *
+ * This file is part of pcbmodelgen.
+ *
+ * pcbmodelgen is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pcbmodelgen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with pcbmodelgen.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Zone with a hole bridged to its outline, as KiCad stores filled zones, must merge with
+// traces touching it into one polygon that keeps the hole.
+
+#include "ems_union.hpp"
+
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <vector>
+
+using namespace kicad_to_ems::pems;
+
+typedef std::complex<double> point_t;
+
+static double area(const point_t* Points, size_t Count)
+{
+    double sum = 0;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        point_t a = Points[i];
+        point_t b = Points[(i + 1) % Count];
+        sum += a.real() * b.imag() - b.real() * a.imag();
+    }
+    return sum / 2;
+}
+
+static bool merge_with_zone(const char* Name, const std::vector<point_t>& Trace,
+                            double Area)
+{
+    // 10 x 10 square with 2 x 2 hole bridged from the left side
+    std::vector<point_t> zone = {{0, 0}, {10, 0}, {10, 10}, {0, 10}, {0, 5}, {4, 5},
+                                 {4, 6},  {6, 6},  {6, 4},   {4, 4},  {4, 5}, {0, 5}};
+
+    PolygonUnion merge;
+    merge.Add(zone.data(), zone.size());
+    merge.Add(Trace.data(), Trace.size());
+    merge.Run();
+    if (merge.MergedCount() != 1 || !merge.IsMerged(0) || !merge.IsMerged(1))
+    {
+        printf("%s: merged into %zu polygons\n", Name, merge.MergedCount());
+        return false;
+    }
+
+    size_t count;
+    const point_t* outline = merge.GetMerged(0, count);
+    if (std::fabs(area(outline, count) - Area) > 1e-9)
+    {
+        printf("%s: area %g, expected %g\n", Name, area(outline, count), Area);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+    // crosses the zone away from the hole
+    ok &= merge_with_zone("crossing trace", {{8, -1}, {9, -1}, {9, 11}, {8, 11}}, 98);
+    // covers start of the bridge, hole must be bridged again
+    ok &= merge_with_zone("trace over bridge", {{-1, 4.5}, {1, 4.5}, {1, 5.5}, {-1, 5.5}}, 97);
+    // runs along the bridge into the hole
+    ok &= merge_with_zone("trace into hole", {{-1, 4.8}, {5, 4.8}, {5, 5.2}, {-1, 5.2}}, 96.8);
+    return ok ? 0 : 1;
+}